@@ -1,10 +1,26 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each hash bucket has its own lock, so lookups of different
+// blocks on different harts do not contend.  bcache.lock is only
+// taken on a miss, to serialize recycling of buffers between buckets.
+//
+// Buffer data lives in pages from kalloc(), BPP buffers per page.
+// The cache starts with NBUF buffers and grows a page at a time, up
+// to NBUFMAX, instead of evicting.  When the page allocator runs dry,
+// kalloc() calls breclaim() to take back a page of unused buffers.
+// Since kalloc() may be called with a p->lock held, bio.c never calls
+// wakeup() while holding bcache.lock or a bucket lock.
+//
+// Buffers that could be recycled -- unused and not dirty -- are kept
+// on two lists, cold and hot, oldest first, so a miss finds its
+// victim at the head of a list instead of searching the buckets.
+// bcache.lrulock guards the lists and is taken after any other lock.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -12,6 +28,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * A dirty buffer is never recycled; the log's
+//     checkpointer thread writes it home and clears b->dirty.
 
 
 #include "types.h"
@@ -22,34 +40,290 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bstat.h"
 
-struct {
+#define BPP (PGSIZE / BSIZE)  // buffers per data page
+#define NBUCKET 13
+#define NGHOST 256            // remembered blocks recycled while cold
+
+extern struct bstat bstats[NCPU];  // bstat.c
+
+// Count an event in this CPU's statistics.
+#define BSTAT_INC(field) do { \
+  push_off(); \
+  bstats[cpuid()].field++; \
+  pop_off(); \
+} while(0)
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+#define GHASH(dev, blockno) (((dev) * 31 + (blockno)) % NGHOST)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;    // list of buffers hashed here, through prev/next.
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  // serializes recycling, growth and reclaim; taken before any bucket lock.
+  struct spinlock lock;
+  struct buf buf[NBUFMAX];
+  char *page[NBUFMAX/BPP];  // data page of buf[i*BPP..], or 0 if not backed
+  int nbuf;                 // number of buffers backed by a page
+  int nwait;                // processes in bget() waiting for a free buffer
+  struct buf *freelist;     // backed buffers holding no block, through next
+  struct bucket bucket[NBUCKET];
+  struct spinlock lrulock;  // guards cold and hot
+  struct buf cold;          // recyclable buffers not hot, through lprev/lnext
+  struct buf hot;           // recyclable hot buffers, through lprev/lnext
+  int ncold;                // cached blocks not hot, in use or not
+#ifndef BCACHE_LRU
+  struct {
+    uint dev;
+    uint blockno;
+    short next;             // next slot+1 on this hash chain, or 0
+  } ghost[NGHOST];          // 2Q A1out ring; dev 0 marks an empty slot
+  short ghash[NGHOST];      // first slot+1 of each ghost hash chain, or 0
+  uint nghost;              // ghost entries ever added
+#endif
 } bcache;
 
+// Back a group of BPP unused buffers with page pa
+// and put them on the free list.
+// Caller must hold bcache.lock.
+static void
+bgrow(char *pa)
+{
+  struct buf *b;
+  int i, j;
+
+  for(i = 0; i < NBUFMAX/BPP; i++){
+    if(bcache.page[i] == 0)
+      break;
+  }
+  if(i == NBUFMAX/BPP){
+    kfree(pa);
+    return;
+  }
+
+  bcache.page[i] = pa;
+  for(j = 0; j < BPP; j++){
+    b = &bcache.buf[i*BPP + j];
+    b->data = (uchar*)pa + j*BSIZE;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->next = bcache.freelist;
+    bcache.freelist = b;
+  }
+  bcache.nbuf += BPP;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  char *pa;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  bcache.cold.lprev = bcache.cold.lnext = &bcache.cold;
+  bcache.hot.lprev = bcache.hot.lnext = &bcache.hot;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  while(bcache.nbuf < NBUF){
+    if((pa = kalloc()) == 0)
+      panic("binit");
+    acquire(&bcache.lock);
+    bgrow(pa);
+    release(&bcache.lock);
+  }
+}
+
+// Look for block on device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Append b, now recyclable, to the tail of its list.
+// Caller must hold bcache.lrulock.
+static void
+lruput(struct buf *b)
+{
+  struct buf *l = b->hot ? &bcache.hot : &bcache.cold;
+
+  b->lnext = l;
+  b->lprev = l->lprev;
+  l->lprev->lnext = b;
+  l->lprev = b;
+}
+
+// Take b off its list, if it is on one.
+// Caller must hold bcache.lrulock.
+static void
+lrudel(struct buf *b)
+{
+  if(b->lnext == 0)
+    return;
+  b->lnext->lprev = b->lprev;
+  b->lprev->lnext = b->lnext;
+  b->lprev = b->lnext = 0;
+}
+
+// Take a reference to b, which is no longer recyclable.
+// Caller must hold b's bucket lock.
+static void
+bref(struct buf *b)
+{
+  if(b->refcnt++ == 0){
+    acquire(&bcache.lrulock);
+    lrudel(b);
+    release(&bcache.lrulock);
+  }
+}
+
+#ifdef BCACHE_LRU
+
+// Strict LRU: no block is ever hot, so bpick() always
+// takes the unused buffer released longest ago.
+static void bevict(struct buf *b) { }
+static int bghost(uint dev, uint blockno) { return 0; }
+
+#else
+
+// 2Q: a block enters the cache cold (A1in).  Cold buffers are
+// recycled first while they fill more than a quarter of the cache,
+// so a large one-pass scan only churns through cold buffers.
+// Repeated references in quick succession, like readi() walking
+// a block 512 bytes at a time, do not make a block hot.  Instead
+// a recycled cold block is remembered in a ring of ghost entries
+// (A1out); if it is requested again before its ghost is
+// overwritten, it comes back hot (Am).  Hot buffers are recycled
+// in LRU order.
+
+// Take slot i, which holds a ghost, off its hash chain
+// and mark it empty.
+// Caller must hold bcache.lock.
+static void
+gunlink(int i)
+{
+  short *pp;
+
+  pp = &bcache.ghash[GHASH(bcache.ghost[i].dev, bcache.ghost[i].blockno)];
+  while(*pp != i+1)
+    pp = &bcache.ghost[*pp-1].next;
+  *pp = bcache.ghost[i].next;
+  bcache.ghost[i].dev = 0;
+}
+
+// Remember the block a cold buffer held as it is recycled,
+// overwriting the oldest ghost.
+// Caller must hold bcache.lock.
+static void
+bevict(struct buf *b)
+{
+  int i = bcache.nghost % NGHOST;
+  short *pp;
+
+  if(b->hot || !b->valid)
+    return;
+  if(bcache.ghost[i].dev != 0)
+    gunlink(i);
+  bcache.ghost[i].dev = b->dev;
+  bcache.ghost[i].blockno = b->blockno;
+  pp = &bcache.ghash[GHASH(b->dev, b->blockno)];
+  bcache.ghost[i].next = *pp;
+  *pp = i+1;
+  bcache.nghost++;
+}
+
+// Was the block recently recycled from the cold queue?
+// If so, forget the ghost entry and return 1.
+// Only the block's hash chain is searched.
+// Caller must hold bcache.lock.
+static int
+bghost(uint dev, uint blockno)
+{
+  int i;
+
+  for(i = bcache.ghash[GHASH(dev, blockno)]; i != 0; i = bcache.ghost[i-1].next){
+    if(bcache.ghost[i-1].dev == dev && bcache.ghost[i-1].blockno == blockno){
+      gunlink(i-1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#endif
+
+// Pick the unused buffer to recycle: the oldest cold one while
+// cold blocks fill more than a quarter of the cache, otherwise
+// the oldest hot one.
+// Caller must hold bcache.lock.
+static struct buf*
+bpick(void)
+{
+  struct buf *b;
+
+  acquire(&bcache.lrulock);
+  if(bcache.cold.lnext != &bcache.cold &&
+     (bcache.ncold > bcache.nbuf / 4 || bcache.hot.lnext == &bcache.hot))
+    b = bcache.cold.lnext;
+  else if(bcache.hot.lnext != &bcache.hot)
+    b = bcache.hot.lnext;
+  else
+    b = 0;
+  release(&bcache.lrulock);
+  return b;
+}
+
+// Choose an unused buffer in any bucket according to the
+// replacement policy and unlink it from its bucket.
+// Caller must hold bcache.lock, which keeps buffers in their
+// buckets, but a hit in bget() can still take the chosen
+// buffer before its bucket is locked; then choose again.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  while((b = bpick()) != 0){
+    bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && !b->dirty){
+      acquire(&bcache.lrulock);
+      lrudel(b);
+      release(&bcache.lrulock);
+      b->next->prev = b->prev;
+      b->prev->next = b->next;
+      release(&bk->lock);
+      if(!b->hot)
+        bcache.ncold--;
+      if(b->valid)
+        BSTAT_INC(evictions);
+      bevict(b);
+      return b;
+    }
+    release(&bk->lock);
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +333,252 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+  char *pa;
+  int nomem = 0;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    bref(b);
+    release(&bk->lock);
+    BSTAT_INC(hits);
+    if(b->lock.locked)
+      BSTAT_INC(lockwaits);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  acquire(&bcache.lock);
+  for(;;){
+    // Another process may have cached it while bk->lock was
+    // released, so look again now that recycling is serialized.
+    acquire(&bk->lock);
+    if((b = bfind(bk, dev, blockno)) != 0){
+      bref(b);
+      release(&bk->lock);
       release(&bcache.lock);
+      BSTAT_INC(hits);
+      if(b->lock.locked)
+        BSTAT_INC(lockwaits);
       acquiresleep(&b->lock);
       return b;
     }
+    release(&bk->lock);
+
+    if((b = bcache.freelist) != 0){
+      bcache.freelist = b->next;
+      break;
+    }
+
+    // Grow the cache rather than evict.  kalloc() may call
+    // breclaim(), so bcache.lock must not be held across it.
+    if(bcache.nbuf < NBUFMAX && !nomem){
+      release(&bcache.lock);
+      pa = kalloc();
+      acquire(&bcache.lock);
+      if(pa)
+        bgrow(pa);
+      else
+        nomem = 1;
+      continue;
+    }
+
+    // Recycle an unused buffer chosen by the replacement policy.
+    // nwait is raised first so that a brelse() after the lists
+    // were found empty sees it and wakes us (see bfreed()).
+    bcache.nwait++;
+    if((b = bvictim()) != 0){
+      bcache.nwait--;
+      break;
+    }
+
+    // Every buffer is in use; wait for a brelse().
+    BSTAT_INC(bufwaits);
+    sleep(&bcache, &bcache.lock);
+    bcache.nwait--;
   }
-  panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->hot = bghost(dev, blockno);
+  if(!b->hot)
+    bcache.ncold++;
+  BSTAT_INC(misses);
+
+  acquire(&bk->lock);
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+  release(&bk->lock);
+
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Take the BPP buffers backed by page i out of the cache.
+// Fails, leaving them in place, unless they are all unused.
+// Caller must hold bcache.lock.
+static int
+bdetach(int i)
+{
+  struct buf *b, **pp;
+  struct bucket *bk;
+  int j, k, onfree[BPP];
+
+  for(j = 0; j < BPP; j++){
+    b = &bcache.buf[i*BPP + j];
+
+    // On the free list?
+    onfree[j] = 0;
+    for(pp = &bcache.freelist; *pp; pp = &(*pp)->next){
+      if(*pp == b){
+        *pp = b->next;
+        onfree[j] = 1;
+        break;
+      }
+    }
+    if(onfree[j])
+      continue;
+
+    bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    if(b->refcnt != 0 || b->dirty){
+      release(&bk->lock);
+      goto bad;
+    }
+    acquire(&bcache.lrulock);
+    lrudel(b);
+    release(&bcache.lrulock);
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    release(&bk->lock);
+    if(!b->hot)
+      bcache.ncold--;
+  }
+  return 1;
+
+bad:
+  // Put back the buffers already taken out.
+  for(k = 0; k < j; k++){
+    b = &bcache.buf[i*BPP + k];
+    if(onfree[k]){
+      b->next = bcache.freelist;
+      bcache.freelist = b;
+      continue;
+    }
+    bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    b->next = bk->head.next;
+    b->prev = &bk->head;
+    bk->head.next->prev = b;
+    bk->head.next = b;
+    acquire(&bcache.lrulock);
+    lruput(b);
+    release(&bcache.lrulock);
+    release(&bk->lock);
+    if(!b->hot)
+      bcache.ncold++;
+  }
+  return 0;
+}
+
+// Shrink the cache by one page of unused buffers and give
+// the page back to kalloc().  Never shrinks below NBUF buffers.
+// Called by kalloc() when it is out of memory.
+// Returns 1 if a page was freed.
+int
+breclaim(void)
+{
+  int i;
+  char *pa;
+
+  acquire(&bcache.lock);
+  for(i = NBUFMAX/BPP - 1; i >= 0 && bcache.nbuf - BPP >= NBUF; i--){
+    if(bcache.page[i] == 0 || !bdetach(i))
+      continue;
+    pa = bcache.page[i];
+    bcache.page[i] = 0;
+    bcache.nbuf -= BPP;
+    release(&bcache.lock);
+    kfree(pa);
+    return 1;
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// A buffer's refcnt dropped to zero; wake processes waiting
+// for one in bget().  The unlocked check of nwait is safe: a
+// waiter raises nwait before it looks at the recyclable lists,
+// and bcache.lrulock orders that look against bunref() putting
+// the buffer on a list, so either the waiter finds the buffer
+// or we see nwait.  Taking bcache.lock makes sure the waiter
+// is asleep.
+static void
+bfreed(void)
+{
+  int nwait;
+
+  if(bcache.nwait == 0)
+    return;
+  acquire(&bcache.lock);
+  nwait = bcache.nwait;
+  release(&bcache.lock);
+  if(nwait)
+    wakeup(&bcache);
+}
+
+// Drop a reference to b.
+// If it is now unused and clean, it becomes the newest
+// recyclable buffer on its list.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  int freed;
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  freed = (b->refcnt == 0);
+  if(freed && !b->dirty){
+    acquire(&bcache.lrulock);
+    lruput(b);
+    release(&bcache.lrulock);
+  }
+  release(&bk->lock);
+
+  if(freed)
+    bfreed();
+}
+
+// Number of buffers in the cache.
+int
+bcachesize(void)
+{
+  return bcache.nbuf;
+}
+
+// Add up the acquire and spin counts of the bucket locks
+// and bcache.lock into st.
+void
+bcachelockstats(struct bstat *st)
+{
+  struct bucket *bk;
+
+  st->bktacq = st->bktspin = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    st->bktacq += bk->lock.n;
+    st->bktspin += bk->lock.nts;
+  }
+  st->bcacheacq = bcache.lock.n;
+  st->bcachespin = bcache.lock.nts;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +595,137 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it from the disk, for a caller about to overwrite all of it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Sort n buffers by block number.
+static void
+bsort(struct buf **bv, int n)
+{
+  for(int i = 1; i < n; i++){
+    struct buf *b = bv[i];
+    int j;
+    for(j = i; j > 0 && bv[j-1]->blockno > b->blockno; j--)
+      bv[j] = bv[j-1];
+    bv[j] = b;
+  }
+}
+
+// Return locked bufs with the contents of the n distinct blocks
+// in blocknos, in bufs[0..n-1].  Buffers are locked in block
+// order, and all the blocks that are not cached are read with
+// one batch of disk requests, consecutive blocks sharing one.
+void
+breadn(uint dev, uint *blocknos, int n, struct buf **bufs)
+{
+  struct buf *sorted[NBATCH];
+  int order[NBATCH];
+  int i, nmiss;
+
+  if(n > NBATCH)
+    panic("breadn");
+
+  // bget() in block order, so two breadn()s can't deadlock.
+  for(i = 0; i < n; i++){
+    int j;
+    for(j = i; j > 0 && blocknos[order[j-1]] > blocknos[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  nmiss = 0;
+  for(i = 0; i < n; i++){
+    struct buf *b = bget(dev, blocknos[order[i]]);
+    bufs[order[i]] = b;
+    if(!b->valid)
+      sorted[nmiss++] = b;
+  }
+
+  if(nmiss > 0){
+    virtio_disk_rwv(sorted, nmiss, 0);
+    for(i = 0; i < nmiss; i++)
+      sorted[i]->valid = 1;
+  }
+}
+
+// Read the indicated block into data without caching it, for
+// bulk readers that would otherwise push hot blocks out of the
+// cache.  A cached copy may be newer than the disk (see
+// buf.dirty), so it is used if present; dirty buffers are never
+// evicted, so an uncached block is current on disk.  The device
+// writes data directly: it must be memory from kalloc() or the
+// kernel image, not the stack.
+void
+bread_direct(uint dev, uint blockno, uchar *data)
+{
+  struct buf *b, db;
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0)
+    bref(b);
+  release(&bk->lock);
+
+  if(b){
+    acquiresleep(&b->lock);
+    if(b->valid){
+      memmove(data, b->data, BSIZE);
+      brelse(b);
+      return;
+    }
+    brelse(b);
+  }
+
+  memset(&db, 0, sizeof(db));
+  db.dev = dev;
+  db.blockno = blockno;
+  db.data = data;
+  virtio_disk_rw(&db, 0);
+}
+
+// Start reading the indicated block into the cache, without
+// waiting for it.  Does nothing if the block is already cached.
+// The buffer stays locked until bdone() runs, so a bread() of
+// the block meanwhile waits for the transfer to finish.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  virtio_disk_rw_async(b, 0);
+}
+
+// Called from the disk interrupt handler when the read
+// started by breadahead() has finished.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +735,25 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the n locked buffers in bufs to disk, merging
+// consecutive blocks into single disk requests.
+void
+bwriten(struct buf **bufs, int n)
+{
+  struct buf *sorted[NBATCH];
+
+  if(n > NBATCH)
+    panic("bwriten");
+  for(int i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwriten");
+    sorted[i] = bufs[i];
+  }
+  bsort(sorted, n);
+  virtio_disk_rwv(sorted, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +761,19 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bunref(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  bref(b);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  bunref(b);
 }
-
-
@@ -0,0 +1,76 @@
+//
+// Buffer cache and disk statistics.
+// bio.c and virtio_disk.c count events in per-CPU
+// counters; reading the bstat device returns their sum.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "bstat.h"
+
+struct bstat bstats[NCPU];
+
+// Account a disk request that was in flight for the given
+// number of timer cycles (10 per microsecond on qemu).
+// Interrupts must be disabled.
+void
+bstat_disk(int write, uint64 cycles)
+{
+  struct bstat *st = &bstats[cpuid()];
+  uint64 us = cycles / 10;
+  int i;
+
+  if(write)
+    st->writes++;
+  else
+    st->reads++;
+  st->waitus += us;
+  for(i = 0; i < NBSTATHIST-1 && us >= (2UL << i); i++)
+    ;
+  st->waithist[i]++;
+}
+
+// Copy the sum of all CPUs' counters to dst.
+// The counters are read without locking, so a
+// snapshot may be off by an event in flight.
+static int
+bstatread(int user_dst, uint64 dst, int n)
+{
+  struct bstat sum;
+  struct bstat *st;
+  int i;
+
+  memset(&sum, 0, sizeof(sum));
+  for(st = bstats; st < &bstats[NCPU]; st++){
+    sum.hits += st->hits;
+    sum.misses += st->misses;
+    sum.evictions += st->evictions;
+    sum.lockwaits += st->lockwaits;
+    sum.bufwaits += st->bufwaits;
+    sum.reads += st->reads;
+    sum.writes += st->writes;
+    sum.waitus += st->waitus;
+    for(i = 0; i < NBSTATHIST; i++)
+      sum.waithist[i] += st->waithist[i];
+  }
+  sum.nbuf = bcachesize();
+  bcachelockstats(&sum);
+
+  if(n > sizeof(sum))
+    n = sizeof(sum);
+  if(either_copyout(user_dst, dst, &sum, n) == -1)
+    return -1;
+  return n;
+}
+
+void
+bstatinit(void)
+{
+  devsw[BSTAT].read = bstatread;
+}
@@ -0,0 +1,21 @@
+// Buffer cache and disk statistics, read from the bstat device.
+// Both the kernel and user programs use this header file.
+
+#define NBSTATHIST 16  // buckets in the disk wait-time histogram
+
+struct bstat {
+  uint64 hits;       // bget() found the block cached
+  uint64 misses;     // bget() had to assign a buffer
+  uint64 evictions;  // a buffer holding a block was recycled
+  uint64 lockwaits;  // bget() found the buffer's sleep-lock held
+  uint64 bufwaits;   // bget() slept because every buffer was in use
+  uint64 reads;      // disk reads completed
+  uint64 writes;     // disk writes completed
+  uint64 waitus;     // microseconds disk requests spent in flight
+  uint64 waithist[NBSTATHIST]; // requests that took [2^i, 2^(i+1)) us
+  uint64 nbuf;       // buffers in the cache now
+  uint64 bktacq;     // acquires of the bcache bucket locks
+  uint64 bktspin;    // spins waiting for a bucket lock
+  uint64 bcacheacq;  // acquires of bcache.lock
+  uint64 bcachespin; // spins waiting for bcache.lock
+};
@@ -1,12 +1,18 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int dirty;   // committed, but not yet written to its home location
+  uint logged; // seq of the last uncommitted log transaction to modify it, or 0
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int hot;          // 2Q: re-referenced after leaving the cold queue
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *lprev; // cold or hot list of recyclable buffers, or 0
+  struct buf *lnext;
+  struct buf *ionext; // next buffer of a multi-block disk request
+  uchar *data;      // BSIZE bytes in a page owned by the cache
 };
 
@@ -1,4 +1,5 @@
 struct buf;
+struct bstat;
 struct context;
 struct file;
 struct inode;
@@ -13,10 +14,23 @@ void log_commit(void);
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
+void            breadahead(uint, uint);
+void            breadn(uint, uint*, int, struct buf**);
+void            bread_direct(uint, uint, uchar*);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriten(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             breclaim(void);
+int             bcachesize(void);
+void            bcachelockstats(struct bstat*);
+
+// bstat.c
+void            bstatinit(void);
+void            bstat_disk(int, uint64);
 
 // console.c
 void            consoleinit(void);
@@ -33,15 +47,23 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filesync(struct file*, int);
+int             fileseek(struct file*, int, int);
+int             fileallocate(struct file*, uint, uint);
+int             fileruns(struct file*);
 int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            bsuminit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
+int             ireclaim(void);
+void            iinval(uint);
+void            isuminit(int);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -51,9 +73,14 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readi_direct(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
-void            itrunc(struct inode*);
+int             itrunc(struct inode*);
+uint            ireadahead(struct inode*, uint, uint);
+uint            igrow(struct inode*, uint);
+void            irsv(struct inode*, uint);
+uint            iruns(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -67,8 +94,16 @@ void            kinit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
+int             log_maxop(void);
 void            log_write(struct buf*);
+void            log_ordered(struct buf*);
+void            log_freed(uint);
+int             log_isfreed(uint);
+int             log_inrunning(uint);
+uint            log_seq(void);
+void            log_sync(uint);
 void            begin_op(void);
+void            begin_opn(int, int);
 void            end_op(void);
 
 // pipe.c
@@ -107,6 +142,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(void (*)(void), char*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -184,6 +220,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rw_async(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,12 +102,93 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Wait until the changes made to file f so far are on disk.
+// If data is set, just those to its contents and size (that is,
+// fdatasync rather than fsync).
+int
+filesync(struct file *f, int data)
+{
+  uint seq;
+
+  if(f->type != FD_INODE && f->type != FD_DEVICE)
+    return -1;
+  ilock(f->ip);
+  seq = f->ip->datasyncseq;
+  if(!data && f->ip->syncseq > seq)
+    seq = f->ip->syncseq;
+  iunlock(f->ip);
+  log_sync(seq);
+  return 0;
+}
+
+// Move f's offset to off bytes from the start, the current
+// offset or the end, as whence says.  Offsets past the end
+// are refused, since files cannot have holes.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base < 0 || base + off < 0 || base + off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+// Read-ahead window bounds, in blocks.
+#define RA_MIN   4
+#define RA_MAX  32
+
+// Called after a read of f that left f->off at the next byte.
+// A read that starts where the previous one ended is sequential:
+// keep the blocks up to a window past f->off in flight, refilling
+// when half the window has been consumed and doubling the window
+// each time.  Any other read resets the window.
+// Caller must hold f->ip->lock.
+static void
+fileahead(struct file *f, int seq)
+{
+  uint bn = f->off / BSIZE;
+
+  f->ra_off = f->off;
+  if(!seq){
+    f->ra_win = 0;
+    return;
+  }
+  if(f->ra_win == 0){
+    f->ra_win = RA_MIN;
+    f->ra_next = bn;
+  }
+  if(f->ra_next < bn)
+    f->ra_next = bn;
+  if(f->ra_next - bn <= f->ra_win / 2){
+    f->ra_next = ireadahead(f->ip, f->ra_next, bn + f->ra_win);
+    if(f->ra_win < RA_MAX)
+      f->ra_win *= 2;
+  }
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
   int r = 0;
+  int seq;
 
   if(f->readable == 0)
     return -1;
@@ -119,8 +201,14 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    seq = (f->off == f->ra_off);
+    if(f->direct){
+      if((r = readi_direct(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+    } else if((r = readi(f->ip, 1, addr, f->off, n)) > 0){
       f->off += r;
+      fileahead(f, seq);
+    }
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,6 +217,46 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Indirect blocks a write of fewer than NINDIRECT blocks can
+// change: two at the bottom level, two in the middle one and
+// the top of the triple-indirect tree.
+#define IND 5
+
+// Most bytes of a file filewrite() writes in one transaction.
+// A write is split into chunks to avoid exceeding the maximum
+// log transaction size, reserving the i-node, IND indirect
+// blocks and an allocation block for each, an allocation block
+// per data block, and 2 blocks of slop for non-aligned writes.
+// With ordered data (see log_ordered()) the data blocks don't
+// count against the log.  A chunk may take up to half of the
+// log, leaving the rest to other operations.
+// This really belongs lower down, since writei() might be
+// writing a device like the console.
+static int
+wchunk(void)
+{
+  int lmax = log_maxop() / 2;
+  if(lmax < MAXOPBLOCKS)
+    lmax = MAXOPBLOCKS;
+#ifdef LOG_JOURNAL_DATA
+  return ((lmax-1-2*IND-2*2) / 2) * BSIZE;
+#else
+  return (lmax-1-2*IND-2) * BSIZE;
+#endif
+}
+
+// Begin the transaction for writing a chunk of n bytes.
+static void
+begin_chunk(int n)
+{
+  int nb = n/BSIZE + 2;  // blocks it can touch
+#ifdef LOG_JOURNAL_DATA
+  begin_opn(1+2*IND+2*nb, 0);
+#else
+  begin_opn(1+2*IND+nb, nb);
+#endif
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,20 +274,14 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = wchunk();
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_chunk(n1);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -180,3 +302,62 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Allocate the blocks for bytes [off, off+len) of file f up
+// front, extending it with zeros if it is shorter, so that
+// they are as contiguous as the free space allows: the first
+// allocation opens a reservation window (see iballoc()) big
+// enough for all of them.  Like writes, it goes a chunk per
+// transaction.
+int
+fileallocate(struct file *f, uint off, uint len)
+{
+  struct inode *ip = f->ip;
+  uint end = off + len;
+  uint n, size;
+  int max;
+
+  if(f->type != FD_INODE || f->writable == 0)
+    return -1;
+  if(end < off || end > MAXFILE*BSIZE)
+    return -1;
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    return -1;
+  }
+  if(end > ip->size)
+    irsv(ip, (end - 1)/BSIZE - ip->size/BSIZE + 1);
+  iunlock(ip);
+
+  max = wchunk();
+  for(;;){
+    begin_chunk(max);
+    ilock(ip);
+    size = ip->size;
+    n = end - size > max ? size + max : end;
+    if(size < end)
+      size = igrow(ip, n);
+    iunlock(ip);
+    end_op();
+    if(size >= end)
+      return 0;
+    if(size < n)
+      return -1;  // out of disk space
+  }
+}
+
+
+// Number of runs of contiguous disk blocks holding file f,
+// a measure of how fragmented it is.
+int
+fileruns(struct file *f)
+{
+  int n;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  n = iruns(f->ip);
+  iunlock(f->ip);
+  return n;
+}
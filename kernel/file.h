@@ -7,6 +7,10 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  uint ra_off;       // FD_INODE: off at which a sequential read continues
+  uint ra_win;       // FD_INODE: read-ahead window in blocks, 0 if not sequential
+  uint ra_next;      // FD_INODE: first block not yet read ahead
+  char direct;       // FD_INODE: opened O_DIRECT, bypass the buffer cache
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,15 +22,25 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // hash chain, or free list
+  struct inode *prev; // LRU list of cached unused inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
+  char flags;
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  uint syncseq;       // last log transaction to change the inode
+  uint datasyncseq;   // last one to change its data or size
+  uint ahint;         // where to look for its next block (see iballoc)
+  int rsv;            // its reservation window's slot + 1; bsum.lock
+  uint rsvwant;       // blocks for its next window, if more than usual
 };
 
 // map major device number to device functions.
@@ -38,3 +52,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define BSTAT   2
@@ -22,10 +22,44 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define RUNMAX 16  // most blocks readi() and writei() move at once
+#define RSVBLOCKS 64  // blocks in a reservation window (see iballoc)
+#define TRUNCBLOCKS (MAXOPBLOCKS/2)  // log blocks one itrunc() call may add
+
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// In-memory summary of the free-block bitmap, so that balloc()
+// need not read bitmap blocks that have nothing free.  A count
+// is updated just after the bitmap bits it describes change.
+// It also keeps the reservation windows of referenced inodes,
+// at most one each; ip->rsv is the slot of ip's, plus one.
+#define NBMAP (FSSIZE/BPB + 1)  // most bitmap blocks
+struct {
+  struct spinlock lock;
+  int n;              // bitmap blocks
+  uint nfree[NBMAP];  // free blocks in each bitmap block's range
+  uint rotor;         // next-fit start for allocations without a hint
+  struct {
+    struct inode *ip; // owner, or 0 if the slot is unused
+    uint start, end;  // blocks [start, end) are kept for ip
+  } rsv[NINODE];
+} bsum;
+
+// In-memory count of the free inodes in each inode block, so
+// that ialloc() reads only blocks with a free inode.  Like
+// bsum it is rebuilt from the disk after recovery, and a
+// count changes just after the inode types it covers do,
+// inside the same transaction.
+#define NIBLK 256  // most inode blocks
+struct {
+  struct spinlock lock;
+  int n;              // inode blocks
+  uchar nfree[NIBLK]; // free inodes in each
+  int rotor;          // where ialloc() starts looking
+} isum;
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,49 +78,342 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  initlock(&bsum.lock, "bsum");
+  bsuminit(dev);
+  initlock(&isum.lock, "isum");
+  isuminit(dev);
 }
 
-// Zero a block.
+// The data argument of the block allocators below: 0 for
+// metadata, 1 for file data, or BFULL for file data that the
+// caller overwrites whole in the same transaction, which need
+// not be zeroed first.
+#define BFULL 2
+
+// Zero a block, a file data block if data is set.  Its old
+// contents are not read, and a BFULL block is left as is.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
+  if(data == BFULL){
+    brelse(bp);
+    return;
+  }
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_ordered(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Index of the lowest set bit of x, which must not be 0.
+// (__builtin_ctzll would need libgcc on cores without Zbb.)
+static int
+ctz64(uint64 x)
+{
+  static const char debruijn[64] = {
+     0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+  };
+
+  return debruijn[((x & -x) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+// Find a clear bit in [from, limit) of bitmap block data, 64
+// bits at a time.  If nw is set, find instead the first bit of
+// nw consecutive words that are all clear.  Returns its index,
+// or -1.
+static int
+bscan(uchar *data, int from, int limit, int nw)
+{
+  uint64 *w = (uint64*)data;
+  uint64 free;
+  int i, k, bi;
+
+  for(i = from / 64; i * 64 < limit; i++){
+    if(nw){
+      if(i == from / 64 && from % 64)
+        continue;
+      for(k = 0; k < nw && (i+k+1) * 64 <= limit && w[i+k] == 0; k++)
+        ;
+      if(k == nw)
+        return i * 64;
+      i += k;  // word i+k is not clear
+      continue;
+    }
+    free = ~w[i];
+    if(i == from / 64)
+      free &= ~0ULL << (from % 64);
+    if(free){
+      bi = i * 64 + ctz64(free);
+      return bi < limit ? bi : -1;
+    }
+  }
+  return -1;
+}
+
+// Blocks described by bitmap block i.
+static int
+bspan(int i)
+{
+  return sb.size - i*BPB < BPB ? sb.size - i*BPB : BPB;
+}
+
+// Count the free blocks of each bitmap block.  Called at boot,
+// after recovery, and after the bitmap is rewritten wholesale.
+void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int i, bi, nfree;
+
+  if((sb.size + BPB - 1) / BPB > NBMAP)
+    panic("bsuminit: bitmap too large");
+  for(i = 0; i * BPB < sb.size; i++){
+    bp = bread(dev, BBLOCK(i*BPB, sb));
+    nfree = 0;
+    for(bi = bscan(bp->data, 0, bspan(i), 0); bi >= 0;
+        bi = bscan(bp->data, bi + 1, bspan(i), 0))
+      nfree++;
+    brelse(bp);
+    acquire(&bsum.lock);
+    bsum.nfree[i] = nfree;
+    release(&bsum.lock);
+  }
+  acquire(&bsum.lock);
+  bsum.n = i;
+  release(&bsum.lock);
+}
+
+// Add delta to the free count of block b's bitmap block.
+static void
+bsumadd(uint b, int delta)
+{
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB] += delta;
+  release(&bsum.lock);
+}
+
+// If block b lies in the reservation window of an inode other
+// than ip, return the end of that window, else 0.
+static uint
+rsvheld(struct inode *ip, uint b)
+{
+  uint end;
+  int i;
+
+  end = 0;
+  acquire(&bsum.lock);
+  for(i = 0; i < NINODE; i++){
+    if(bsum.rsv[i].ip != 0 && bsum.rsv[i].ip != ip &&
+       bsum.rsv[i].start <= b && b < bsum.rsv[i].end){
+      end = bsum.rsv[i].end;
+      break;
+    }
+  }
+  release(&bsum.lock);
+  return end;
+}
+
+// Get ip's reservation window, empty if it has none.
+static void
+rsvget(struct inode *ip, uint *start, uint *end)
+{
+  acquire(&bsum.lock);
+  *start = *end = 0;
+  if(ip->rsv){
+    *start = bsum.rsv[ip->rsv-1].start;
+    *end = bsum.rsv[ip->rsv-1].end;
+  }
+  release(&bsum.lock);
+}
+
+// Make [start, end) ip's reservation window, unless NINODE
+// other inodes have windows already.
+static void
+rsvset(struct inode *ip, uint start, uint end)
+{
+  int i;
+
+  acquire(&bsum.lock);
+  if(ip->rsv == 0){
+    for(i = 0; i < NINODE && bsum.rsv[i].ip != 0; i++)
+      ;
+    if(i == NINODE){
+      release(&bsum.lock);
+      return;
+    }
+    bsum.rsv[i].ip = ip;
+    ip->rsv = i + 1;
+  }
+  bsum.rsv[ip->rsv-1].start = start;
+  bsum.rsv[ip->rsv-1].end = end;
+  release(&bsum.lock);
+}
+
+// Give up ip's reservation window, if it has one, leaving
+// the free blocks in it to other inodes.
+static void
+rsvdrop(struct inode *ip)
+{
+  acquire(&bsum.lock);
+  if(ip->rsv){
+    bsum.rsv[ip->rsv-1].ip = 0;
+    ip->rsv = 0;
+  }
+  release(&bsum.lock);
+}
+
+// Allocate a zeroed disk block for ip, to hold file data if
+// data is set.  Next-fit: the first free block from goal on,
+// wrapping around the disk, that is not in another inode's
+// reservation window unless no other is free.  If nw is set,
+// only the first block of nw free 64-block bitmap words will
+// do, and finding none is not worth a message.  Bitmap blocks
+// with too little free are skipped without reading them.
+// Blocks freed by the running transaction are not taken
+// (see log_freed()).
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(struct inode *ip, uint goal, int data, int nw)
 {
-  int b, bi, m;
+  int i, k, from, limit, bi, skip;
+  uint nfree, end, dev;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  dev = ip->dev;
+  if(goal >= sb.size)
+    goal = 0;
+  skip = 1;
+ again:
+  // the goal's bitmap block is visited twice: from goal
+  // to its end first, and its start again last.
+  for(k = 0; k <= bsum.n; k++){
+    i = (goal / BPB + k) % bsum.n;
+    acquire(&bsum.lock);
+    nfree = bsum.nfree[i];
+    release(&bsum.lock);
+    if(nfree == 0 || nfree < nw * 64)
+      continue;
+    from = k == 0 ? goal % BPB : 0;
+    limit = k == bsum.n ? goal % BPB : bspan(i);
+    bp = bread(dev, BBLOCK(i*BPB, sb));
+    while((bi = bscan(bp->data, from, limit, nw)) >= 0){
+      if(skip && (end = rsvheld(ip, i*BPB + bi)) != 0)
+        from = end - i*BPB;  // skip the window
+      else if(log_isfreed(i*BPB + bi))
+        from = bi + 1;       // still the old owner's on disk
+      else
+        break;
+    }
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[i]--;
+      bsum.rotor = i*BPB + bi + 1;
+      release(&bsum.lock);
+      bzero(dev, i*BPB + bi, data);
+      return i*BPB + bi;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
+  if(skip && nw == 0){
+    // the last free blocks are in windows: take one anyway.
+    skip = 0;
+    goto again;
+  }
+  if(nw == 0)
+    printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate disk block b for ip, zeroed, if it is free and not
+// in another inode's reservation window (nor freed by the
+// running transaction), so that a file can grow contiguously.
+// Returns 0 if b is taken.
+static uint
+balloc_at(struct inode *ip, uint b, int data)
+{
+  struct buf *bp;
+  int bi, m;
+
+  if(b >= sb.size || rsvheld(ip, b) || log_isfreed(b))
+    return 0;
+  bp = bread(ip->dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;
+  log_write(bp);
+  brelse(bp);
+  bsumadd(b, -1);
+  bzero(ip->dev, b, data);
+  return b;
+}
+
+// Allocate a block for ip, next-fit from just past the last
+// block allocated for it, so that its blocks stay together
+// and allocations don't rescan the same full part of the
+// bitmap.  An inode without a hint yet starts at the rotor.
+//
+// The blocks come from ip's reservation window, a run that
+// other inodes' allocations stay out of, so that files
+// written a little at a time side by side don't interleave.
+// The first extending write, or one that finds the next block
+// taken, opens a window of RSVBLOCKS at the next free block.
+// After fallocate(), the window of ip->rsvwant blocks starts
+// instead at enough whole free bitmap words if there are any,
+// so the file can be one run; doing that for every window
+// would scatter small files and cut up the free space.  The
+// window is dropped with the inode.
+// Caller must hold ip->lock.
+static uint
+iballoc(struct inode *ip, int data)
+{
+  uint b, start, end, want;
+  int nw;
+
+  rsvget(ip, &start, &end);
+  if(start <= ip->ahint && ip->ahint < end &&
+     (b = balloc_at(ip, ip->ahint, data)) != 0){
+    ip->ahint = b + 1;
+    return b;
+  }
+
+  if(ip->ahint == 0){
+    acquire(&bsum.lock);
+    ip->ahint = bsum.rotor;
+    release(&bsum.lock);
+  }
+  want = RSVBLOCKS;
+  nw = 0;
+  if(ip->rsvwant > RSVBLOCKS){
+    want = ip->rsvwant;
+    nw = min((want + 63) / 64, BPB / 64);
+  }
+  ip->rsvwant = 0;
+  while((b = balloc(ip, ip->ahint, data, nw)) == 0 && nw > 0)
+    nw = nw > 1 ? 1 : 0;
+  if(b != 0){
+    rsvset(ip, b, b + want);
+    ip->ahint = b + 1;
+  }
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -102,6 +429,8 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  bsumadd(b, 1);
+  log_freed(b);
 }
 
 // Inodes.
@@ -129,18 +458,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to a table entry (open files and
+//   current directories). iget() finds or creates a table
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero is kept, in LRU order, so
+//   that a later iget() of the same inode finds it; iget()
+//   recycles the least recently used one when it needs an
+//   entry and the table can't grow.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, which stays set while the entry is cached,
+//   while iput() clears ip->valid if it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,54 +495,200 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The table is a hash table on (dev, inum).  Its entries live
+// in pages from kalloc(), IPP per page; it starts with NINODE
+// and grows a page at a time, up to NINODEMAX, before it
+// recycles cached entries.  When the page allocator runs dry,
+// kalloc() calls ireclaim() to take back a page of unused ones.
+//
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, or the hash chains and the LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define IPP (PGSIZE / sizeof(struct inode))  // entries per page
+#define NIPAGE ((NINODEMAX + IPP - 1) / IPP)
+#define NIHASH 127
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *page[NIPAGE];   // pages of entries, or 0
+  int n;                        // entries in those pages
+  struct inode *free;           // entries holding no inode, through hnext
+  struct inode *hash[NIHASH];   // chains of cached entries, through hnext
+  struct inode lru;             // head of the list of unused cached
+                                // entries, most recently used first
 } itable;
 
+// Add the IPP entries of page pa to the free list.
+// Caller must hold itable.lock.
+static void
+igrowtable(char *pa)
+{
+  struct inode *ip;
+  int i, j;
+
+  for(i = 0; i < NIPAGE; i++){
+    if(itable.page[i] == 0)
+      break;
+  }
+  if(i == NIPAGE){
+    kfree(pa);
+    return;
+  }
+
+  itable.page[i] = (struct inode*)pa;
+  for(j = 0; j < IPP; j++){
+    ip = &itable.page[i][j];
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    ip->hnext = itable.free;
+    itable.free = ip;
+  }
+  itable.n += IPP;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  char *pa;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.lru.prev = itable.lru.next = &itable.lru;
+  while(itable.n < NINODE){
+    if((pa = kalloc()) == 0)
+      panic("iinit");
+    acquire(&itable.lock);
+    igrowtable(pa);
+    release(&itable.lock);
   }
 }
 
+// Take ip off the LRU list.
+// Caller must hold itable.lock.
+static void
+iunlru(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Take ip out of its hash chain.
+// Caller must hold itable.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+}
+
+// Look for the inode on device dev with number inum in the table.
+// Caller must hold itable.lock.
+static struct inode*
+ifind(uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
 static struct inode* iget(uint dev, uint inum);
 
+// Count the free inodes in each inode block.  Called at boot,
+// after recovery, and after the inode blocks are rewritten
+// wholesale.  Inode 0 is never allocated.
+void
+isuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int i, j, nfree;
+
+  if(sb.ninodes / IPB + 1 > NIBLK)
+    panic("isuminit: too many inodes");
+  for(i = 0; i * IPB < sb.ninodes; i++){
+    bp = bread(dev, IBLOCK(i * IPB, sb));
+    dip = (struct dinode*)bp->data;
+    nfree = 0;
+    for(j = 0; j < IPB && i * IPB + j < sb.ninodes; j++){
+      if(i * IPB + j != 0 && dip[j].type == 0)
+        nfree++;
+    }
+    brelse(bp);
+    acquire(&isum.lock);
+    isum.nfree[i] = nfree;
+    release(&isum.lock);
+  }
+  acquire(&isum.lock);
+  isum.n = i;
+  isum.rotor = 0;
+  release(&isum.lock);
+}
+
+// Add delta to the free count of inum's inode block.
+static void
+isumadd(uint inum, int delta)
+{
+  acquire(&isum.lock);
+  isum.nfree[inum / IPB] += delta;
+  if(delta > 0 && inum / IPB < isum.rotor)
+    isum.rotor = inum / IPB;
+  release(&isum.lock);
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
+// Only inode blocks with a free inode are read, starting at
+// the rotor, the lowest block that may have one.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, j, inum, nfree;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  acquire(&isum.lock);
+  i = isum.rotor;
+  release(&isum.lock);
+  for(; i < isum.n; i++){
+    acquire(&isum.lock);
+    nfree = isum.nfree[i];
+    if(nfree == 0 && i == isum.rotor)
+      isum.rotor = i + 1;
+    release(&isum.lock);
+    if(nfree == 0)
+      continue;
+    bp = bread(dev, IBLOCK(i * IPB, sb));
+    for(j = 0; j < IPB; j++){
+      inum = i * IPB + j;
+      if(inum == 0 || inum >= sb.ninodes)
+        continue;
+      dip = (struct dinode*)bp->data + j;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        brelse(bp);
+        isumadd(inum, -1);
+        return iget(dev, inum);
+      }
     }
+    // another process took the last one.
     brelse(bp);
   }
   printf("ialloc: no inodes\n");
@@ -231,6 +708,7 @@ iupdate(struct inode *ip)
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
+  dip->flags = ip->flags;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
@@ -238,6 +716,7 @@ iupdate(struct inode *ip)
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  ip->syncseq = log_seq();
 }
 
 // Find the inode with number inum on device dev
@@ -246,36 +725,135 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  char *pa;
+  int nomem = 0;
 
   acquire(&itable.lock);
-
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(;;){
+    // Is the inode already in the table?  Look again after
+    // itable.lock was released to grow the table.
+    if((ip = ifind(dev, inum)) != 0){
+      if(ip->ref++ == 0)
+        iunlru(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    if((ip = itable.free) != 0){
+      itable.free = ip->hnext;
+      break;
+    }
 
-  ip = empty;
+    // Grow the table rather than recycle.  kalloc() may call
+    // ireclaim(), so itable.lock must not be held across it.
+    if(itable.n < NINODEMAX && !nomem){
+      release(&itable.lock);
+      pa = kalloc();
+      acquire(&itable.lock);
+      if(pa)
+        igrowtable(pa);
+      else
+        nomem = 1;
+      continue;
+    }
+
+    // Recycle the least recently used unused entry.
+    if((ip = itable.lru.prev) == &itable.lru)
+      panic("iget: no inodes");
+    iunlru(ip);
+    iunhash(ip);
+    break;
+  }
+
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  // the entry may have been recycled while a change to the inode
+  // was still being committed; fsync() must wait for that too.
+  ip->syncseq = ip->datasyncseq = log_seq();
+  ip->ahint = 0;
+  ip->rsvwant = 0;
   release(&itable.lock);
 
   return ip;
 }
 
+// Take the IPP entries of page i out of the table.
+// Fails, leaving them in place, unless they are all unused.
+// Caller must hold itable.lock.
+static int
+idetach(int i)
+{
+  struct inode *ip, **pp;
+  int j;
+
+  for(j = 0; j < IPP; j++){
+    if(itable.page[i][j].ref != 0)
+      return 0;
+  }
+  for(j = 0; j < IPP; j++){
+    ip = &itable.page[i][j];
+    for(pp = &itable.free; *pp && *pp != ip; pp = &(*pp)->hnext)
+      ;
+    if(*pp){
+      *pp = ip->hnext;  // on the free list
+      continue;
+    }
+    iunlru(ip);
+    iunhash(ip);
+  }
+  return 1;
+}
+
+// Shrink the inode table by one page of unused entries and
+// give the page back to kalloc().  Never shrinks below NINODE
+// entries.  Called by kalloc() when it is out of memory.
+// Returns 1 if a page was freed.
+int
+ireclaim(void)
+{
+  int i;
+  char *pa;
+
+  acquire(&itable.lock);
+  for(i = NIPAGE - 1; i >= 0 && itable.n - IPP >= NINODE; i--){
+    if(itable.page[i] == 0 || !idetach(i))
+      continue;
+    pa = (char*)itable.page[i];
+    itable.page[i] = 0;
+    itable.n -= IPP;
+    release(&itable.lock);
+    kfree(pa);
+    return 1;
+  }
+  release(&itable.lock);
+  return 0;
+}
+
+// Forget the cached copies of dev's unused inodes, after
+// the inode blocks were rewritten behind the table's back.
+void
+iinval(uint dev)
+{
+  struct inode *ip, *next;
+
+  acquire(&itable.lock);
+  for(ip = itable.lru.next; ip != &itable.lru; ip = next){
+    next = ip->next;
+    if(ip->dev != dev)
+      continue;
+    iunlru(ip);
+    iunhash(ip);
+    ip->hnext = itable.free;
+    itable.free = ip;
+  }
+  release(&itable.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -304,6 +882,7 @@ ilock(struct inode *ip)
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
+    ip->flags = dip->flags;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
@@ -347,9 +926,16 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
+    // a large file takes several transactions to free (see
+    // itrunc()).  No one else can be waiting for ip->lock, so
+    // it can be held across them.
+    while(!itrunc(ip)){
+      end_op();
+      begin_op();
+    }
     ip->type = 0;
     iupdate(ip);
+    isumadd(ip->inum, 1);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -357,6 +943,14 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
+  if(ip->ref == 1){
+    rsvdrop(ip);
+    // keep the entry cached, most recently used first.
+    ip->next = itable.lru.next;
+    ip->prev = &itable.lru;
+    itable.lru.next->prev = ip;
+    itable.lru.next = ip;
+  }
   ip->ref--;
   release(&itable.lock);
 }
@@ -374,20 +968,207 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT after
+// those hang off ip->addrs[NDIRECT+1] through two levels of
+// indirect blocks, and the last NTINDIRECT off
+// ip->addrs[NDIRECT+2] through three.
+//
+// An inode with DI_EXTENT set maps its content by extents
+// instead (see struct extent): each is a run of contiguous
+// blocks, so one lookup finds many blocks, and they can be
+// moved in a single disk request.
+
+// Look for file block bn in the ne extents at e, the first of
+// which starts at file block *base.  Returns the index of the
+// extent holding bn, or else of the first unused one, or ne;
+// *base is advanced past the extents before that index.
+static int
+efind(struct extent *e, int ne, uint bn, uint *base)
+{
+  int i;
+
+  for(i = 0; i < ne && e[i].len != 0; i++){
+    if(bn < *base + e[i].len)
+      return i;
+    *base += e[i].len;
+  }
+  return i;
+}
+
+// bmap() for extent-mapped inodes.  Also sets *n to the number
+// of blocks, at most *n, in the run from bn on.  Block bn may
+// be just past the end of the file, in which case up to *n
+// blocks are allocated, next to the file's last block when it
+// is free so that the last extent grows.  The first nfull of
+// them are not zeroed (see bmapw()).
+// returns 0 if out of disk space or extents.
+static uint
+emap(struct inode *ip, uint bn, uint *n, uint nfull)
+{
+  struct extent *ie = (struct extent*)ip->addrs;
+  struct extent *e, *prev;
+  struct buf *bp, *pbp;
+  uint base, addr, want;
+  int i, ne, data, full;
+
+  bp = pbp = 0;
+  prev = 0;
+  base = 0;
+  e = ie;
+  ne = NIEXTENT;
+  i = efind(e, ne, bn, &base);
+  if(i == NIEXTENT && ip->addrs[NDIRECT+2] != 0){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+2]);
+    prev = &ie[NIEXTENT-1];
+    e = (struct extent*)bp->data;
+    ne = NBEXTENT;
+    i = efind(e, ne, bn, &base);
+  }
+  if(i > 0){
+    prev = &e[i-1];
+    pbp = bp;
+  }
+
+  if(i < ne && e[i].len != 0){
+    addr = e[i].start + (bn - base);
+    if(*n > e[i].len - (bn - base))
+      *n = e[i].len - (bn - base);
+    goto out;
+  }
+
+  // bn is not mapped: append it.  Files have no holes.
+  addr = 0;
+  want = *n;
+  *n = 0;
+  if(bn != base)
+    goto out;
+  data = ip->type == T_FILE;
+  full = data && nfull > 0 ? BFULL : data;
+  if(prev == 0 || (addr = balloc_at(ip, prev->start + prev->len, full)) == 0){
+    if(i == ne && bp)
+      goto out;  // out of extents
+    if((addr = iballoc(ip, full)) == 0)
+      goto out;
+    if(i == ne){
+      // the inline extents are used up: start the extent block,
+      // past ip's reservation window so as not to split the run.
+      uint start, end;
+      rsvget(ip, &start, &end);
+      if((ip->addrs[NDIRECT+2] = balloc(ip, end, 0, 0)) == 0){
+        bfree(ip->dev, addr);
+        addr = 0;
+        goto out;
+      }
+      bp = bread(ip->dev, ip->addrs[NDIRECT+2]);
+      e = (struct extent*)bp->data;
+      i = 0;
+    }
+    prev = &e[i];
+    pbp = e == ie ? 0 : bp;
+    prev->start = addr;
+    prev->len = 0;
+  }
+  prev->len++;
+  for(*n = 1; *n < want; (*n)++){
+    if(balloc_at(ip, addr + *n, data && *n < nfull ? BFULL : data) == 0)
+      break;
+    prev->len++;
+  }
+  ip->ahint = addr + *n;
+  if(pbp)
+    log_write(pbp);
+
+ out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Charge *budget for logging bitmap block b in the running
+// transaction, unless it is logged there already.
+// Returns 0 if the budget is spent.
+static int
+tcharge(int *budget, uint b)
+{
+  if(log_inrunning(b))
+    return 1;
+  if(*budget <= 0)
+    return 0;
+  (*budget)--;
+  return 1;
+}
+
+// itrunc() for extent-mapped inodes: free ip's blocks from the
+// last one back, until *budget runs out, and set *low to the
+// number left.  Returns 1 once none are left.
+static int
+eshrink(struct inode *ip, int *budget, uint *low)
+{
+  struct extent *ie = (struct extent*)ip->addrs;
+  struct extent *be, *e;
+  struct buf *bp;
+  int ni, nb, n;
+
+  *low = 0;
+  for(ni = 0; ni < NIEXTENT && ie[ni].len != 0; ni++)
+    *low += ie[ni].len;
+  bp = 0;
+  be = 0;
+  nb = 0;
+  if(ip->addrs[NDIRECT+2]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+2]);
+    be = (struct extent*)bp->data;
+    for(; nb < NBEXTENT && be[nb].len != 0; nb++)
+      *low += be[nb].len;
+  }
+
+  for(n = ni + nb; n > 0; ){
+    e = n > ni ? &be[n-ni-1] : &ie[n-1];
+    if(!tcharge(budget, BBLOCK(e->start + e->len - 1, sb)))
+      break;
+    bfree(ip->dev, e->start + e->len - 1);
+    (*low)--;
+    if(--e->len == 0){
+      e->start = 0;
+      n--;
+    }
+  }
+
+  if(bp == 0)
+    return n == 0;
+  if(n <= ni && tcharge(budget, BBLOCK(bp->blockno, sb))){
+    // the extent block is empty.
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+2]);
+    ip->addrs[NDIRECT+2] = 0;
+    return n == 0;
+  }
+  if(nb > 0)
+    log_write(bp);
+  brelse(bp);
+  return 0;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, zeroed unless
+// full says the caller overwrites it whole (see bmapw()).
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int full)
 {
-  uint addr, *a;
+  uint addr, *a, span;
   struct buf *bp;
+  int level, data;
+
+  if(ip->flags & DI_EXTENT){
+    uint n = 1;
+    return emap(ip, bn, &n, full);
+  }
 
+  data = ip->type != T_FILE ? 0 : full ? BFULL : 1;
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip, data);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,60 +1177,214 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  // Find the tree holding bn; one with level levels of
+  // indirect blocks maps span blocks.
+  span = NINDIRECT;
+  for(level = 1; bn >= span; level++){
+    if(level == 3)
+      panic("bmap: out of range");
+    bn -= span;
+    span *= NINDIRECT;
+  }
+
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+    addr = iballoc(ip, 0);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level-1] = addr;
+  }
+
+  // Load each indirect block on the way down, allocating
+  // if necessary.
+  for(; level > 0; level--){
+    span /= NINDIRECT;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      addr = iballoc(ip, level == 1 ? data : 0);
       if(addr){
-        a[bn] = addr;
+        a[bn / span] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+    bn %= span;
   }
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Like bmap(), but also set *n to the number of blocks, at most
+// *n, in the run of contiguous blocks from bn on.  Only
+// extent-mapped inodes have runs longer than a block.
+// For writei(): the caller overwrites the first nfull blocks
+// of the run whole in the current transaction, so the ones
+// allocated are not zeroed first; if the write fails part way,
+// the caller must zero what it left.
+static uint
+bmapw(struct inode *ip, uint bn, uint *n, uint nfull)
+{
+  if(ip->flags & DI_EXTENT)
+    return emap(ip, bn, n, nfull);
+  *n = 1;
+  return bmap(ip, bn, nfull > 0);
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// bmapw() for callers that don't overwrite whole blocks.
+static uint
+bmapr(struct inode *ip, uint bn, uint *n)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  return bmapw(ip, bn, n, 0);
+}
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+// Free the blocks that indirect block addr maps, last first,
+// until *budget runs out, clearing the pointers to them.  addr
+// has level-1 further levels of indirect blocks below it and
+// maps the file's blocks from base on; *low is set to the
+// lowest one freed.  Once addr maps nothing it is freed too,
+// and the result is 1.
+static int
+ishrink(uint dev, uint addr, int level, uint base, int *budget, uint *low)
+{
+  struct buf *bp;
+  uint *a, span;
+  int j, k, mod;
+
+  span = 1;
+  for(k = 1; k < level; k++)
+    span *= NINDIRECT;
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  mod = 0;
+  for(j = NINDIRECT-1; j >= 0; j--){
+    if(a[j] == 0)
+      continue;
+    if(level > 1){
+      if(!ishrink(dev, a[j], level-1, base + j*span, budget, low))
+        break;
+    } else {
+      if(!tcharge(budget, BBLOCK(a[j], sb)))
+        break;
+      bfree(dev, a[j]);
+      *low = base + j;
     }
+    a[j] = 0;
+    mod = 1;
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
+  if(j < 0 && tcharge(budget, BBLOCK(addr, sb))){
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(dev, addr);
+    return 1;
+  }
+  if(mod)
+    log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Truncate inode (discard contents), freeing its blocks from
+// the last one back.  A large file's blocks can span more
+// bitmap blocks than one operation may log, so a call stops
+// once it has added about TRUNCBLOCKS blocks to the
+// transaction, leaving ip a shorter file, and returns 0; the
+// caller must then begin a new transaction and call again.
+// Returns 1 once ip is empty.
+// The budget is for bitmap blocks.  Stopping part way also
+// logs the indirect or extent blocks on the way down to the
+// last block freed, at most 3, and the inode.
+// Caller must hold ip->lock.
+int
+itrunc(struct inode *ip)
+{
+  static const uint base[3] = {
+    NDIRECT, NDIRECT+NINDIRECT, NDIRECT+NINDIRECT+NDINDIRECT
+  };
+  int i, budget, done;
+  uint low;
+
+  budget = TRUNCBLOCKS - 3;
+  low = MAXFILE;
+  done = 0;
+  if(ip->flags & DI_EXTENT){
+    done = eshrink(ip, &budget, &low);
+    goto out;
   }
 
-  ip->size = 0;
+  for(i = 2; i >= 0; i--){
+    if(ip->addrs[NDIRECT+i] == 0)
+      continue;
+    if(!ishrink(ip->dev, ip->addrs[NDIRECT+i], i+1, base[i], &budget, &low))
+      goto out;
+    ip->addrs[NDIRECT+i] = 0;
+  }
+  for(i = NDIRECT-1; i >= 0; i--){
+    if(ip->addrs[i] == 0)
+      continue;
+    if(!tcharge(&budget, BBLOCK(ip->addrs[i], sb)))
+      goto out;
+    bfree(ip->dev, ip->addrs[i]);
+    ip->addrs[i] = 0;
+    low = i;
+  }
+  done = 1;
+
+ out:
+  if(done){
+    rsvdrop(ip);
+    ip->size = 0;
+  } else if(low < (ip->size + BSIZE - 1) / BSIZE){
+    ip->size = low * BSIZE;
+  }
+  ip->datasyncseq = log_seq();
   iupdate(ip);
+  return done;
+}
+
+// Start asynchronous reads of blocks [bn, end) of ip into the
+// buffer cache, stopping at the end of the file.
+// Blocks below ip->size are always mapped, so bmap()
+// will not allocate.
+// Returns the first block not read ahead.
+// Caller must hold ip->lock.
+uint
+ireadahead(struct inode *ip, uint bn, uint end)
+{
+  uint addr, nb, i, run;
+
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  if(end > nb)
+    end = nb;
+  for(; bn < end; bn += run){
+    run = end - bn;
+    if((addr = bmapr(ip, bn, &run)) == 0)
+      break;
+    for(i = 0; i < run; i++)
+      breadahead(ip->dev, addr + i);
+  }
+  return bn;
+}
+
+// Count the runs of contiguous blocks holding ip's content,
+// a measure of how fragmented it is.  This walks the whole
+// block map, so stati() leaves it to fruns().
+// Caller must hold ip->lock.
+uint
+iruns(struct inode *ip)
+{
+  uint bn, nb, run, addr, end, nrun;
+
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  nrun = end = 0;
+  for(bn = 0; bn < nb; bn += run){
+    run = nb - bn;
+    if((addr = bmapr(ip, bn, &run)) == 0)
+      break;
+    if(addr != end)
+      nrun++;
+    end = addr + run;
+  }
+  return nrun;
 }
 
 // Copy stat information from inode.
@@ -464,34 +1399,111 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Allocate blocks to extend ip to n bytes, for fallocate().
+// The new blocks are zeroed, and as data blocks go through the
+// log in ordered mode.  Returns the size reached, which is
+// less than n if the disk or the extents ran out.
+// Caller must hold ip->lock.
+uint
+igrow(struct inode *ip, uint n)
+{
+  uint bn, nb, run;
+
+  nb = (n + BSIZE - 1) / BSIZE;
+  for(bn = (ip->size + BSIZE - 1) / BSIZE; bn < nb; bn += run){
+    run = nb - bn;
+    if(bmapr(ip, bn, &run) == 0)
+      break;
+  }
+  if(bn < nb)
+    n = bn * BSIZE;
+  if(n > ip->size){
+    ip->size = n;
+    ip->datasyncseq = log_seq();
+    iupdate(ip);
+  }
+  return ip->size;
+}
+
+// Ask that ip's next reservation window hold n blocks, and
+// drop its current one so that the next allocation opens it.
+// Caller must hold ip->lock.
+void
+irsv(struct inode *ip, uint n)
+{
+  rsvdrop(ip);
+  ip->rsvwant = n;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Blocks of a run are read with one breadn(), so the ones
+// not cached go to the disk in one request.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m, i, run, blocknos[RUNMAX];
+  struct buf *bufs[RUNMAX];
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; ){
+    run = min((off + n - tot - 1)/BSIZE - off/BSIZE + 1, RUNMAX);
+    uint addr = bmapr(ip, off/BSIZE, &run);
+    if(addr == 0)
+      break;
+    for(i = 0; i < run; i++)
+      blocknos[i] = addr + i;
+    breadn(ip->dev, blocknos, run, bufs);
+    for(i = 0; i < run; i++, tot+=m, off+=m, dst+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyout(user_dst, dst, bufs[i]->data + (off % BSIZE), m) == -1)
+        break;
+      brelse(bufs[i]);
+    }
+    if(i < run){
+      for(; i < run; i++)
+        brelse(bufs[i]);
+      return -1;
+    }
+  }
+  return tot;
+}
+
+// Like readi, but file blocks are read through a private page
+// with bread_direct() rather than the buffer cache, so a bulk
+// read doesn't evict blocks other processes are using.
+// Indirect blocks are still cached by bmap.
+int
+readi_direct(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  uchar *page;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if((page = (uchar*)kalloc()) == 0)
+    return readi(ip, user_dst, dst, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 0);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
+    bread_direct(ip->dev, addr, page);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
+    if(either_copyout(user_dst, dst, page + (off % BSIZE), m) == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
   }
+  kfree(page);
   return tot;
 }
 
@@ -505,30 +1517,56 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, i, bn, run, nfull, z, blocknos[RUNMAX];
+  struct buf *bufs[RUNMAX];
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+  for(tot=0; tot<n; ){
+    bn = off/BSIZE;
+    run = min((off + n - tot - 1)/BSIZE - bn + 1, RUNMAX);
+    nfull = off%BSIZE == 0 ? (n - tot)/BSIZE : 0;
+    uint addr = bmapw(ip, bn, &run, nfull);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
+    for(i = 0; i < run; i++)
+      blocknos[i] = addr + i;
+    breadn(ip->dev, blocknos, run, bufs);
+    for(i = 0; i < run; i++, tot+=m, off+=m, src+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyin(bufs[i]->data + (off % BSIZE), user_src, src, m) == -1)
+        break;
+      if(ip->type == T_FILE)
+        log_ordered(bufs[i]);
+      else
+        log_write(bufs[i]);
+      brelse(bufs[i]);
+    }
+    if(i < run){
+      // either_copyin() failed.  Blocks allocated for the write
+      // may hold stale data, but what lies past the end of the
+      // file must read as zeros if the file grows over it.
+      for(; i < run; i++){
+        z = (bn + i)*BSIZE < off ? off % BSIZE : 0;  // first byte not written
+        if((bn + i)*BSIZE + z >= ip->size){
+          memset(bufs[i]->data + z, 0, BSIZE - z);
+          if(ip->type == T_FILE)
+            log_ordered(bufs[i]);
+          else
+            log_write(bufs[i]);
+        }
+        brelse(bufs[i]);
+      }
       break;
     }
-    log_write(bp);
-    brelse(bp);
   }
 
   if(off > ip->size)
     ip->size = off;
+  ip->datasyncseq = log_seq();
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
@@ -546,6 +1584,299 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories (see struct dxentry).  A linear directory
+// is converted when its first block is full, so only the ones
+// that grow past 62 entries are hashed.  A lookup reads block 0
+// and one leaf instead of every block; a full leaf is split in
+// two at a hash boundary.  An entry whose leaf is full and
+// can't be split, once the index is full, goes in a block
+// outside the index instead, and a lookup that misses in its
+// leaf searches those blocks linearly.  So a hashed directory
+// holds as many entries as a linear one would.
+
+#define NDE (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// FNV-1a hash of a name.
+static uint
+dirhash(const char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// The index of the hashed directory whose block 0 is bp,
+// and in *n the number of its entries.
+static struct dxentry*
+dxindex(struct buf *bp, int *n)
+{
+  struct dxentry *ix = (struct dxentry*)bp->data + 2;
+
+  for(*n = 0; *n < NDXENT && ix[*n].blk != 0; (*n)++)
+    ;
+  return ix;
+}
+
+// Which of the n index entries ix covers hash h.
+static int
+dxfind(struct dxentry *ix, int n, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(ix[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Is block blk of the directory one of the n leaves in ix?
+static int
+dxleaf(struct dxentry *ix, int n, uint blk)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(ix[i].blk == blk)
+      return 1;
+  }
+  return 0;
+}
+
+// Look for name in block blk of directory dp.  If found, set
+// *poff to the byte offset of its entry and return its inum.
+// Index entries in block 0 look like unused dirents.
+static uint
+dxscan(struct inode *dp, uint blk, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, blk, 0));
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < NDE; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      if(poff)
+        *poff = blk*BSIZE + i*sizeof(*de);
+      inum = de[i].inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// dirlookup() for hashed directories.
+static struct inode*
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *rbp;
+  struct dxentry *ix;
+  uint blk, nblk, inum;
+  int n;
+
+  if((inum = dxscan(dp, 0, name, poff)) != 0)  // "." and ".."
+    return iget(dp->dev, inum);
+
+  rbp = bread(dp->dev, bmap(dp, 0, 0));
+  ix = dxindex(rbp, &n);
+  inum = dxscan(dp, ix[dxfind(ix, n, dirhash(name))].blk, name, poff);
+  // blocks beyond the leaves hold entries that found no room.
+  nblk = dp->size / BSIZE;
+  for(blk = 1; inum == 0 && nblk - 1 > n && blk < nblk; blk++){
+    if(!dxleaf(ix, n, blk))
+      inum = dxscan(dp, blk, name, poff);
+  }
+  brelse(rbp);
+  if(inum == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
+// Split the full leaf in bp, entry k of the index in block 0
+// rbp, moving the entries with the upper half of its hashes to
+// a new leaf at the end of the directory.  Returns -1 if the
+// index is full or all the entries have the same hash.
+static int
+dxsplit(struct inode *dp, struct buf *rbp, int k, struct buf *bp)
+{
+  struct dirent *de = (struct dirent*)bp->data;
+  struct dirent *nde;
+  struct dxentry *ix;
+  struct buf *nbp;
+  uint hs[NDE], h, split, blk, addr;
+  int i, j, n;
+
+  ix = dxindex(rbp, &n);
+  if(n == NDXENT)
+    return -1;
+  split = 0;
+
+  // sort the hashes and find the boundary between two
+  // different ones nearest the middle.
+  for(i = 0; i < NDE; i++){
+    h = dirhash(de[i].name);
+    for(j = i; j > 0 && hs[j-1] > h; j--)
+      hs[j] = hs[j-1];
+    hs[j] = h;
+  }
+  for(j = 0; j < NDE/2; j++){
+    if(hs[NDE/2 + j] != hs[NDE/2 + j - 1]){
+      split = hs[NDE/2 + j];
+      break;
+    }
+    if(hs[NDE/2 - j] != hs[NDE/2 - j - 1]){
+      split = hs[NDE/2 - j];
+      break;
+    }
+  }
+  if(j == NDE/2)
+    return -1;
+
+  blk = dp->size / BSIZE;
+  if((addr = bmap(dp, blk, 0)) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  nbp = bread(dp->dev, addr);
+  nde = (struct dirent*)nbp->data;
+  for(i = j = 0; i < NDE; i++){
+    if(dirhash(de[i].name) >= split){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nbp);
+  brelse(nbp);
+  log_write(bp);
+
+  memmove(&ix[k+2], &ix[k+1], (n - k - 1) * sizeof(*ix));
+  memset(&ix[k+1], 0, sizeof(*ix));
+  ix[k+1].hash = split;
+  ix[k+1].blk = blk;
+  log_write(rbp);
+  return 0;
+}
+
+// Put (name, inum) in a free dirent in a block outside the n
+// leaves of index ix, adding a block if they are all full.
+// For when its leaf is full and can't be split.
+static int
+dxspill(struct inode *dp, struct dxentry *ix, int n, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint blk, nblk;
+  int i;
+
+  nblk = dp->size / BSIZE;
+  for(blk = 1; blk <= nblk; blk++){
+    if(blk < nblk && dxleaf(ix, n, blk))
+      continue;
+    if(blk == nblk){
+      if(bmap(dp, blk, 0) == 0)
+        return -1;
+      dp->size += BSIZE;
+      iupdate(dp);
+    }
+    bp = bread(dp->dev, bmap(dp, blk, 0));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < NDE; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+  }
+  return -1;
+}
+
+// dirlink() for hashed directories, once name is known not
+// to be present.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *rbp, *bp;
+  struct dirent *de;
+  struct dxentry *ix;
+  uint h;
+  int i, k, n;
+
+  h = dirhash(name);
+  for(;;){
+    rbp = bread(dp->dev, bmap(dp, 0, 0));
+    ix = dxindex(rbp, &n);
+    k = dxfind(ix, n, h);
+    bp = bread(dp->dev, bmap(dp, ix[k].blk, 0));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < NDE; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        brelse(rbp);
+        return 0;
+      }
+    }
+    // the leaf is full.  after a split, the half for h has room.
+    if(dxsplit(dp, rbp, k, bp) < 0){
+      brelse(bp);
+      i = dxspill(dp, ix, n, name, inum);
+      brelse(rbp);
+      return i;
+    }
+    brelse(bp);
+    brelse(rbp);
+  }
+}
+
+// Convert dp, a linear directory whose one block is full, to a
+// hashed one: the entries other than "." and ".." move to a
+// single leaf, block 1.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *rbp, *bp;
+  struct dxentry *ix;
+  uint addr;
+  int n;
+
+  if((addr = bmap(dp, 1, 0)) == 0)
+    return -1;
+  rbp = bread(dp->dev, bmap(dp, 0, 0));
+  bp = bread(dp->dev, addr);
+  n = 2*sizeof(struct dirent);
+  memmove(bp->data + n, rbp->data + n, BSIZE - n);
+  memset(rbp->data + n, 0, BSIZE - n);
+  ix = (struct dxentry*)rbp->data + 2;
+  ix[0].hash = 0;
+  ix[0].blk = 1;
+  log_write(bp);
+  log_write(rbp);
+  brelse(bp);
+  brelse(rbp);
+  dp->size = 2*BSIZE;
+  dp->flags |= DI_HASHDIR;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -556,6 +1887,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if(dp->flags & DI_HASHDIR)
+    return dxlookup(dp, name, poff);
 
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -589,6 +1922,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->flags & DI_HASHDIR)
+    return dxlink(dp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -597,6 +1933,10 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // A full one-block directory becomes a hashed one.
+  if(off == BSIZE && dp->size == BSIZE && dxconvert(dp) == 0)
+    return dxlink(dp, name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -25,20 +25,37 @@ struct superblock {
 #define FSMAGIC 0x10203040
 uint calc_inode_blocks(uint ninodes);  // fix parameter type
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
-  short type;           // File type
+  char type;            // File type
+  char flags;           // DI_EXTENT, DI_HASHDIR
   short major;          // Major device number (T_DEVICE only)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
+// dinode.flags
+#define DI_EXTENT 0x1   // addrs[] holds extents, not block numbers
+#define DI_HASHDIR 0x2  // directory with a hash index (see struct dxentry)
+
+// An extent-mapped file's blocks are the runs of its extents in
+// order: NIEXTENT in addrs[], then NBEXTENT more in the extent
+// block addrs[NDIRECT+2].  A run of length 0 ends the list.
+struct extent {
+  uint start;           // first disk block of the run
+  uint len;             // blocks in the run
+};
+#define NIEXTENT ((NDIRECT+2) / 2)
+#define NBEXTENT (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -59,3 +76,19 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A hashed directory (DI_HASHDIR) keeps "." and ".." in block 0,
+// followed by an index of its leaf blocks sorted by the lowest
+// name hash each leaf holds; the first is for hash 0, and one
+// with blk 0 ends the index.  An entry lives in the leaf for its
+// name's hash.  Index entries fill dirent slots and start with
+// a zero inum, so they read as unused dirents.
+struct dxentry {
+  ushort zero;          // always 0, the inum of an unused dirent
+  ushort pad;
+  uint hash;            // lowest name hash in the leaf
+  uint blk;             // leaf's block number within the directory
+  uint pad1;
+};
+
+#define NDXENT (BSIZE / sizeof(struct dirent) - 2)  // most leaves
+
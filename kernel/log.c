@@ -3,6 +3,7 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -10,201 +11,820 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only seals a transaction when there
+// are no FS system calls active. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// its start and end. Usually begin_op() just reserves
+// MAXOPBLOCKS blocks of the transaction and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the running transaction has been sealed.
+// A system call that writes more, such as a large write(),
+// reserves what it needs with begin_opn().
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Commits are done by the committer thread, not by end_op(),
+// so a system call's changes are on disk some time after it
+// returns.  The committer groups all the system calls of a
+// GROUPTICKS window into one transaction (sooner if the log
+// is full, or if fsync() is waiting for it; see log_sync()).
+// It seals the transaction by copying its blocks into a
+// private staging area, and FS system calls then go on with
+// the next transaction while it writes the staged copy.
+//
+// The log is a physical re-do log containing disk blocks,
+// used as a circular journal.  The on-disk log format:
+//   journal superblock, naming the oldest record recovery
+//     must look at and its sequence number
+//   a ring of log.size-1 blocks of transaction records
+//   (mkfs decides log.size):
+//     record header, containing sequence number, block #s
+//       for block A, B, C, ..., and a checksum
+//     block A
+//     block B
+//     block C
+//     ...
+//     next record header
+//     ...
+// A record is written in one batch, header and all: the
+// checksum over the header and the blocks tells recovery
+// whether the whole record reached the disk, so there is no
+// separate commit write.  Recovery replays records from the
+// journal superblock on, for as long as their sequence numbers
+// follow on and their checksums match.  Records are never
+// cleared; the journal superblock is only moved past records
+// once the checkpointer has installed them.
+//
+// Installing committed blocks at their home locations is
+// deferred: the committer marks them dirty in the buffer cache
+// and adds them to the checkpoint set, and the checkpointer
+// thread writes the set home in block order now and then.  A
+// block that several transactions change is written home once,
+// with its latest committed contents.  The checkpointer runs
+// every CKPTTICKS, when the ring is half full, or at once when
+// the committer needs ring space.
+//
+// File data is not journaled (unless the kernel is built with
+// LOG_JOURNAL_DATA): writei() hands data blocks to
+// log_ordered(), and the committer writes them straight to
+// their home locations before it writes the record of the
+// transaction that refers to them.  After a crash a file may
+// hold data newer than its last committed size or block list
+// says, but never blocks that were not written for it.  So a
+// block freed by the running transaction is not reused until
+// the transaction is sealed (see log_freed()): written home
+// early as data, it would overwrite what the old owner, still
+// the owner on disk, holds, and taken as metadata it would
+// keep the previous transaction from writing it as data.
+
+#ifndef GROUPTICKS
+#define GROUPTICKS 1   // longest a transaction stays open, in ticks
+#endif
+#define CKPTTICKS  30  // longest committed blocks wait to be installed
+#define NCKPT      1024  // most blocks in a checkpoint set
+#define LOGMAGIC   0x6a726e6c  // "jrnl"
+#define LOGBLOCKS  ((BSIZE - 24) / sizeof(int))  // block #s a record header holds
+#define NFREED     ((FSSIZE + 7) / 8)  // bytes of the freed-block bitmap
+
+#ifdef LOG_JOURNAL_DATA
+#define JOURNAL_DATA 1
+#else
+#define JOURNAL_DATA 0
+#endif
+
+// Contents of a record header block, also used to keep track
+// in memory of logged block# before commit.
 struct logheader {
+  uint magic;
+  uint seq;
+  int n;
+  uint pad;
+  uint64 csum;  // of the rest of the header and the n blocks
+  int block[LOGBLOCKS];
+};
+
+// Hash index of the block numbers in a logheader's list, so
+// absorption in log_write() doesn't scan the list.  Entries
+// are list positions plus one, chained through next.
+#define LOGHASH 256  // buckets, a power of two
+struct logindex {
+  short head[LOGHASH];
+  short next[LOGBLOCKS];
+};
+
+// Committed blocks awaiting installation, with the ring block
+// (counted from log.tblk's origin) of each one's latest copy.
+// Indexed like a logheader.
+struct ckset {
   int n;
-  int block[LOGSIZE];
+  uint block[NCKPT];
+  uint pos[NCKPT];
+  short next[NCKPT];
+  short head[LOGHASH];
+};
+
+// Contents of the journal superblock.
+struct logsuper {
+  uint magic;
+  uint seq;   // sequence number of the record at tail
+  uint tail;  // ring offset of the first record to replay
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int maxtx;       // most blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int lres;        // log blocks reserved by executing FS sys calls
+  int dres;        // ordered data blocks reserved by them
+  int sealing;     // committer is waiting to seal lh, please wait.
+  int nwait;       // begin_op()s waiting for log space
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the running transaction
+  uint done;       // transactions before done are on disk
+  int nsync;       // log_sync()s waiting for a commit
+  uint opened;     // ticks when lh got its first block
+  uint hblk;       // ring blocks written so far; the next record goes at hblk
+  uint hseq;       // sequence number of the record at hblk
+  uint tblk;       // the journal superblock's tail, counted like hblk
+  int ckforce;     // committer is waiting for ring space
+  int handing;     // handoff() is adding a record to ck[cur]
+  uint cklast;     // ticks at the end of the last checkpoint
+  int cur;         // handoff() adds to ck[cur]
+  struct ckset ck[2];   // the other one is being installed
+  struct logheader lh;  // running transaction
+  struct logheader ld;  // running transaction's ordered data blocks
+  struct logindex lx;   // index of lh
+  struct logindex dx;   // index of ld
+  uchar freed[NFREED];  // blocks freed by the running transaction
+  uint flo, fhi;        // bytes of freed that may have bits set
+  struct logheader ch;  // sealed transaction being committed
+  struct logheader cd;  // ch's ordered data blocks
+  struct buf cbuf[LOGBLOCKS+1]; // ch's record header and staged blocks
+  struct buf ibuf[NBATCH];      // checkpointer's copies of blocks to install,
+                                // and of the journal superblock
+  struct buf obuf[NBATCH];      // committer's copies of cd's blocks
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void committer(void);
+static void checkpointer(void);
+
+// Position of blockno in h's list, or -1.
+static int
+ifind(struct logheader *h, struct logindex *x, uint blockno)
+{
+  int i;
+
+  for (i = x->head[blockno & (LOGHASH-1)]; i != 0; i = x->next[i-1]) {
+    if (h->block[i-1] == blockno)
+      return i-1;
+  }
+  return -1;
+}
+
+// Add blockno to the end of h's list.
+static void
+iadd(struct logheader *h, struct logindex *x, uint blockno)
+{
+  int i = h->n++;
+  int k = blockno & (LOGHASH-1);
+
+  h->block[i] = blockno;
+  x->next[i] = x->head[k];
+  x->head[k] = i+1;
+}
+
+// Empty h's list, clearing just the buckets it used.
+static void
+iclear(struct logheader *h, struct logindex *x)
+{
+  for (int i = 0; i < h->n; i++)
+    x->head[h->block[i] & (LOGHASH-1)] = 0;
+  h->n = 0;
+}
+
+// Position of blockno in checkpoint set c, or -1.
+static int
+cfind(struct ckset *c, uint blockno)
+{
+  int i;
+
+  for (i = c->head[blockno & (LOGHASH-1)]; i != 0; i = c->next[i-1]) {
+    if (c->block[i-1] == blockno)
+      return i-1;
+  }
+  return -1;
+}
+
+// Record that the latest committed copy of blockno is at
+// ring block pos.  The caller makes sure there is room.
+static void
+cadd(struct ckset *c, uint blockno, uint pos)
+{
+  int i = cfind(c, blockno);
+  int k = blockno & (LOGHASH-1);
+
+  if (i < 0) {
+    i = c->n++;
+    c->block[i] = blockno;
+    c->next[i] = c->head[k];
+    c->head[k] = i+1;
+  }
+  c->pos[i] = pos;
+}
+
+// Empty checkpoint set c, clearing just the buckets it used.
+static void
+cclear(struct ckset *c)
+{
+  for (int i = 0; i < c->n; i++)
+    c->head[c->block[i] & (LOGHASH-1)] = 0;
+  c->n = 0;
+}
+
+// Give n private buffers data space from kalloc().
+static void
+stagebufs(struct buf *b, int n)
+{
+  char *pa = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (i % (PGSIZE/BSIZE) == 0 && (pa = kalloc()) == 0)
+      panic("initlog: kalloc");
+    b[i].data = (uchar*)pa + (i % (PGSIZE/BSIZE))*BSIZE;
+    b[i].dev = log.dev;
+  }
+}
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  // a record is a header and the blocks, in a ring of log.size-1.
+  log.maxtx = log.size - 2;
+  if (log.maxtx > LOGBLOCKS)
+    log.maxtx = LOGBLOCKS;
+  if (log.maxtx < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  stagebufs(log.cbuf, log.maxtx+1);
+  stagebufs(log.ibuf, NBATCH);
+  stagebufs(log.obuf, NBATCH);
   recover_from_log();
+  kthread(checkpointer, "checkpointer");
+  kthread(committer, "committer");
+}
+
+// The most blocks a single begin_opn() may reserve.
+int
+log_maxop(void)
+{
+  return log.maxtx;
+}
+
+// Disk block holding ring block pos.
+static uint
+ringblock(uint pos)
+{
+  return log.start + 1 + pos % (log.size - 1);
 }
 
-// Copy committed blocks from log to their home location
+// FNV-1a, a 64-bit word at a time; n is a multiple of 8.
+static uint64
+csum(uint64 h, void *p, int n)
+{
+  uint64 *w = (uint64*)p;
+
+  for (int i = 0; i < n/8; i++)
+    h = (h ^ w[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+// Checksum of record header h, to be continued over its blocks.
+static uint64
+headcsum(struct logheader *h)
+{
+  uint64 sum = csum(0xcbf29ce484222325ULL, h, (char*)&h->csum - (char*)h);
+
+  return csum(sum, h->block, sizeof(h->block));
+}
+
+// Write the journal superblock: recovery will start with
+// record seq at ring offset tail.  Only recovery and the
+// checkpointer call this, and it goes through the
+// checkpointer's first private buffer, not the cache: the
+// cache may be full of dirty buffers that only the
+// checkpointer can clean.
 static void
-install_trans(int recovering)
+write_super(uint seq, int tail)
 {
-  int tail;
+  struct buf *b = &log.ibuf[0];
+  struct logsuper *js = (struct logsuper *) (b->data);
+
+  memset(b->data, 0, BSIZE);
+  js->magic = LOGMAGIC;
+  js->seq = seq;
+  js->tail = tail;
+  b->blockno = log.start;
+  virtio_disk_rw(b, 1);
+}
+
+// If the record at ring offset pos is transaction seq and is
+// intact, copy its blocks from the log to their home locations
+// and return the number of ring blocks it takes; else return 0.
+// Blocks are handled NBATCH at a time.
+static int
+replay(int pos, uint seq)
+{
+  // only recovery runs this, and they would not fit on the stack.
+  static struct buf *lbuf[NBATCH], *dbuf[NBATCH];
+  static uint lblock[NBATCH];
+  struct logheader *hb;
+  struct buf *hbuf;
+  uint64 sum;
+  int i, k, m, n;
+
+  hbuf = bread(log.dev, ringblock(pos));
+  hb = (struct logheader *) (hbuf->data);
+  n = hb->n;
+  if (hb->magic != LOGMAGIC || hb->seq != seq ||
+      n <= 0 || n > LOGBLOCKS || n+1 > log.size-1) {
+    brelse(hbuf);
+    return 0;
+  }
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  sum = headcsum(hb);
+  for (i = 0; i < n; i += m) {
+    m = n - i < NBATCH ? n - i : NBATCH;
+    for (k = 0; k < m; k++)
+      lblock[k] = ringblock(pos+1+i+k);
+    breadn(log.dev, lblock, m, lbuf);          // read log blocks
+    for (k = 0; k < m; k++) {
+      sum = csum(sum, lbuf[k]->data, BSIZE);
+      brelse(lbuf[k]);
+    }
   }
+  if (sum != hb->csum) {
+    // torn record: the crash came before it was all on disk.
+    brelse(hbuf);
+    return 0;
+  }
+
+  for (i = 0; i < n; i += m) {
+    m = n - i < NBATCH ? n - i : NBATCH;
+    for (k = 0; k < m; k++)
+      lblock[k] = ringblock(pos+1+i+k);
+    breadn(log.dev, lblock, m, lbuf);                // read log blocks
+    breadn(log.dev, (uint*)hb->block + i, m, dbuf);  // read dsts
+    for (k = 0; k < m; k++)
+      memmove(dbuf[k]->data, lbuf[k]->data, BSIZE);  // copy block to dst
+    bwriten(dbuf, m);  // write dsts to disk
+    for (k = 0; k < m; k++) {
+      brelse(lbuf[k]);
+      brelse(dbuf[k]);
+    }
+  }
+  brelse(hbuf);
+  return n+1;
 }
 
-// Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+recover_from_log(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct buf *b = bread(log.dev, log.start);
+  struct logsuper *js = (struct logsuper *) (b->data);
+  uint seq = 1;
+  int pos = 0, len;
+
+  if (js->magic == LOGMAGIC) {
+    seq = js->seq;
+    pos = js->tail % (log.size - 1);
+  }
+  brelse(b);
+
+  // if committed, copy from log to disk
+  while ((len = replay(pos, seq)) > 0) {
+    pos = (pos + len) % (log.size - 1);
+    seq++;
   }
-  brelse(buf);
+
+  // everything is installed: start the ring afresh at pos.
+  write_super(seq, pos);
+  log.seq = seq;
+  log.done = seq;
+  log.hseq = seq;
+  log.hblk = pos;
+  log.tblk = pos;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the blocks of checkpoint set c to their home locations,
+// in block order and NBATCH at a time.  Each is copied to the
+// checkpointer's own buffers, one cache buffer locked at a
+// time.  The blocks stay dirty until ckdone().
 static void
-write_head(void)
+install(struct ckset *c)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
+  struct buf *b, *bv[NBATCH];
+  int i, j, k, m;
+  uint bno, pos;
+
+  for (i = 1; i < c->n; i++) {
+    bno = c->block[i];
+    pos = c->pos[i];
+    for (j = i; j > 0 && c->block[j-1] > bno; j--) {
+      c->block[j] = c->block[j-1];
+      c->pos[j] = c->pos[j-1];
+    }
+    c->block[j] = bno;
+    c->pos[j] = pos;
+  }
+
+  for (i = 0; i < c->n; i += m) {
+    m = c->n - i < NBATCH ? c->n - i : NBATCH;
+    for (k = 0; k < m; k++) {
+      bv[k] = &log.ibuf[k];
+      bv[k]->blockno = c->block[i+k];
+      // dirty buffers are never evicted, so this does not read.
+      b = bread(log.dev, c->block[i+k]);
+      if (b->logged) {
+        // Changed again by a transaction that hasn't committed:
+        // the committed contents are only in the log.  The cache
+        // may hold an old copy of the ring block from recovery,
+        // since write_log() bypasses it, so read the disk.
+        bv[k]->blockno = ringblock(c->pos[i+k]);
+        virtio_disk_rw(bv[k], 0);
+        bv[k]->blockno = c->block[i+k];
+      } else {
+        memmove(bv[k]->data, b->data, BSIZE);
+      }
+      brelse(b);
+    }
+
+    virtio_disk_rwv(bv, m, 1);
+  }
+}
+
+// The blocks of checkpoint set c are home, and the journal
+// superblock has moved past their records, so recovery will
+// not replay them.  Only now are they no longer dirty: until
+// then a block freed and reused as ordered data must still be
+// journaled (see log_ordered()), or replay would overwrite it.
+// A block stays dirty if a newer copy has been committed
+// meanwhile and is in log.ck[log.cur].
+static void
+ckdone(struct ckset *c)
+{
+  struct buf *b;
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+
+  for (i = 0; i < c->n; i++) {
+    // dirty buffers are never evicted, so this does not read.
+    b = bread(log.dev, c->block[i]);
+    acquire(&log.lock);
+    if (cfind(&log.ck[log.cur], b->blockno) < 0)
+      b->dirty = 0;
+    release(&log.lock);
+    brelse(b);
   }
-  bwrite(buf);
-  brelse(buf);
+  cclear(c);
 }
 
+// Kernel thread that installs committed transactions.  Each
+// round takes the checkpoint set, which holds every block of
+// the records before log.hblk, and installs it while handoff()
+// fills the other set; then recovery need not look before hblk.
 static void
-recover_from_log(void)
+checkpointer(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct ckset *c;
+  uint hblk, hseq;
+
+  acquire(&log.lock);
+  for (;;) {
+    while (log.handing || log.hblk == log.tblk ||
+           (!log.ckforce && ticks - log.cklast < CKPTTICKS &&
+            log.hblk - log.tblk <= (log.size - 1) / 2))
+      sleep(&ticks, &log.lock);
+
+    c = &log.ck[log.cur];
+    log.cur ^= 1;
+    hblk = log.hblk;
+    hseq = log.hseq;
+    log.ckforce = 0;
+    release(&log.lock);
+
+    install(c);
+    write_super(hseq, hblk % (log.size - 1));
+    ckdone(c);
+
+    acquire(&log.lock);
+    log.tblk = hblk;
+    log.cklast = ticks;
+    wakeup(&log);
+  }
 }
 
-// called at the start of each FS system call.
+// Wake the committer before its group-commit window closes.
+// It sleeps on &ticks so that the clock closes the window.
+static void
+kick(void)
+{
+  wakeup(&ticks);
+}
+
+// called at the start of each FS system call that may log
+// up to nlog blocks and write ndata ordered data blocks.
 void
-begin_op(void)
+begin_opn(int nlog, int ndata)
 {
+  struct proc *p = myproc();
+
+  if(nlog > log.maxtx || ndata > LOGBLOCKS)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.lres + nlog > log.maxtx ||
+              log.ld.n + log.dres + ndata > LOGBLOCKS){
+      // this op might exhaust log space; wait for the
+      // committer to seal the running transaction.
+      log.nwait += 1;
+      kick();
       sleep(&log, &log.lock);
+      log.nwait -= 1;
     } else {
       log.outstanding += 1;
+      log.lres += nlog;
+      log.dres += ndata;
+      p->logres = nlog;
+      p->datares = ndata;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS, MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.lres -= p->logres;
+  log.dres -= p->datares;
+  // the committer may be waiting for the last operation of
+  // the transaction it is sealing, and begin_op() may be
+  // waiting for the log space this op had reserved.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Copy the blocks of the sealed transaction ch from the cache
+// to the staging buffers.  No FS system call is active, so the
+// cache holds exactly what the transaction wrote.
+static void
+seal(void)
+{
+  int i;
+
+  for (i = 0; i < log.ch.n; i++) {
+    struct buf *b = bread(log.dev, log.ch.block[i]);
+    memmove(log.cbuf[i+1].data, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Write ch's ordered data blocks to their home locations, in
+// one batch, and unpin them.  They are copied one cache buffer
+// at a time, since FS system calls are running again.  A block
+// logged since it was written has become metadata of a later
+// transaction, which supersedes the data.
+static void
+write_ordered(void)
+{
+  struct buf *b, *bv[NBATCH];
+  int i, j, n, bno;
+
+  for (i = 1; i < log.cd.n; i++) {
+    bno = log.cd.block[i];
+    for (j = i; j > 0 && log.cd.block[j-1] > bno; j--)
+      log.cd.block[j] = log.cd.block[j-1];
+    log.cd.block[j] = bno;
+  }
+
+  for (i = 0; i < log.cd.n; ) {
+    n = 0;
+    for (; i < log.cd.n && n < NBATCH; i++) {
+      b = bread(log.dev, log.cd.block[i]);
+      if (!b->logged) {
+        bv[n] = &log.obuf[n];
+        bv[n]->blockno = b->blockno;
+        memmove(bv[n]->data, b->data, BSIZE);
+        n++;
+      }
+      brelse(b);
+    }
+    virtio_disk_rwv(bv, n, 1);
+  }
+
+  // only now may the cache drop them: a read before the write
+  // finished would find the old contents on disk.
+  for (i = 0; i < log.cd.n; i++) {
+    b = bread(log.dev, log.cd.block[i]);
+    bunpin(b);
+    brelse(b);
   }
+}
+
+// Write the record of ch, header and staged blocks, at ring
+// block pos.  This is the true point at which the transaction
+// commits.  The record is contiguous unless it wraps around
+// the ring, so it takes a request or two per MAXRUN blocks,
+// all in flight at once.
+static void
+write_log(uint pos, uint seq)
+{
+  // only the committer runs this, and it would not fit on its stack.
+  static struct buf *bv[LOGBLOCKS+1];
+  struct logheader *hb = (struct logheader *) (log.cbuf[0].data);
+  uint64 sum;
+  int i;
+
+  *hb = log.ch;
+  hb->magic = LOGMAGIC;
+  hb->seq = seq;
+  sum = headcsum(hb);
+  for (i = 0; i < log.ch.n; i++)
+    sum = csum(sum, log.cbuf[i+1].data, BSIZE);
+  hb->csum = sum;
+
+  for (i = 0; i <= log.ch.n; i++) {
+    log.cbuf[i].blockno = ringblock(pos+i);
+    bv[i] = &log.cbuf[i];
+  }
+  virtio_disk_rwv(bv, log.ch.n+1, 1);
+}
+
+// Mark the blocks of the transaction that was just written at
+// ring block pos dirty, so the cache keeps them until they are
+// home, and add them to the checkpoint set.  A block that a
+// later transaction has changed again stays logged by that
+// transaction.  The checkpointer doesn't take the set until
+// the whole record is in it and hblk is past it; else it
+// could install part of the record and clear the dirty flags
+// of blocks that recovery would still replay.
+static void
+handoff(uint seq, uint pos)
+{
+  int tail;
+
+  acquire(&log.lock);
+  log.handing = 1;
   release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+  for (tail = 0; tail < log.ch.n; tail++) {
+    struct buf *b = bread(log.dev, log.ch.block[tail]);
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    b->dirty = 1;
+    if (b->logged == seq)
+      b->logged = 0;
+    cadd(&log.ck[log.cur], b->blockno, pos+1+tail);
     release(&log.lock);
+    bunpin(b);
+    brelse(b);
   }
+
+  acquire(&log.lock);
+  log.hblk = pos + log.ch.n + 1;
+  log.hseq = seq + 1;
+  log.handing = 0;
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Kernel thread that commits transactions.  A transaction is
+// sealed once it has been open GROUPTICKS, or as soon as an
+// operation is waiting for log space, and after its last
+// operation has ended.
 static void
-write_log(void)
+committer(void)
 {
-  int tail;
+  uint seq, pos;
+
+  acquire(&log.lock);
+  for (;;) {
+    while ((log.lh.n == 0 && log.ld.n == 0) ||
+           (ticks - log.opened < GROUPTICKS && log.nwait == 0 &&
+            log.nsync == 0))
+      sleep(&ticks, &log.lock);
+
+    // keep new operations out until the transaction is sealed.
+    log.sealing = 1;
+    while (log.outstanding > 0)
+      sleep(&log, &log.lock);
+    log.ch = log.lh;
+    log.cd = log.ld;
+    iclear(&log.lh, &log.lx);
+    iclear(&log.ld, &log.dx);
+    if (log.fhi > log.flo)
+      memset(log.freed + log.flo, 0, log.fhi - log.flo);
+    log.flo = log.fhi = 0;
+    seq = log.seq++;
+    release(&log.lock);
+
+    seal();
+
+    acquire(&log.lock);
+    log.sealing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_ordered();  // data first, so no record names unwritten blocks
+    if (log.ch.n == 0) {
+      acquire(&log.lock);
+      log.done = seq + 1;
+      wakeup(&log.done);
+      continue;
+    }
+
+    // Only the ring space the checkpointer has freed, and room
+    // in the checkpoint set, force a checkpoint.
+    acquire(&log.lock);
+    while (log.hblk + log.ch.n + 1 - log.tblk > log.size - 1 ||
+           log.ck[log.cur].n + log.ch.n > NCKPT) {
+      log.ckforce = 1;
+      kick();
+      sleep(&log, &log.lock);
+    }
+    pos = log.hblk;
+    release(&log.lock);
+
+    write_log(pos, seq);  // Write the record -- the real commit
+    handoff(seq, pos);    // Leave installing to the checkpointer
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    acquire(&log.lock);
+    log.done = seq + 1;
+    wakeup(&log.done);
   }
 }
 
-static void
-commit()
+// Sequence number of the running transaction.  Called inside
+// an FS system call, it names the transaction that will carry
+// the call's changes.
+uint
+log_seq(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  seq = log.seq;
+  release(&log.lock);
+  return seq;
+}
+
+// Wait until transaction seq, and so every one before it, is
+// on disk.  If seq is still running it is committed now rather
+// than at the end of its GROUPTICKS window.  Not to be called
+// inside an FS system call, which would keep seq open.
+void
+log_sync(uint seq)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  acquire(&log.lock);
+  while (log.done <= seq) {
+    int force = seq == log.seq;  // else it is being committed
+    // a running transaction with nothing in it has nothing to commit.
+    if (force && log.lh.n == 0 && log.ld.n == 0)
+      break;
+    log.nsync += force;
+    kick();
+    sleep(&log.done, &log.lock);
+    log.nsync -= force;
   }
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// The committer will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,20 +837,105 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
+  b->logged = log.seq;
+  i = ifind(&log.lh, &log.lx, b->blockno);   // log absorption
+  if (i < 0) {  // Add new block to log?
+    if (log.lh.n >= log.maxtx)
+      panic("too big a transaction");
+    bpin(b);
+    if (log.lh.n == 0 && log.ld.n == 0)
+      log.opened = ticks;
+    iadd(&log.lh, &log.lx, b->blockno);
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  release(&log.lock);
+}
+
+// Like log_write(), for a file data block: instead of going
+// through the log, b will be written to its home location just
+// before the running transaction commits.  A block that some
+// transaction still has to install from the log (logged or
+// dirty) is journaled after all, since writing it home early
+// could overwrite metadata a crash would need.
+void
+log_ordered(struct buf *b)
+{
+  int i;
+
+  if (JOURNAL_DATA || b->logged || b->dirty) {
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_ordered outside of trans");
+  i = ifind(&log.ld, &log.dx, b->blockno);
+  if (i < 0) {
+    if (log.ld.n >= LOGBLOCKS)
+      panic("too many ordered blocks");
     bpin(b);
-    log.lh.n++;
+    if (log.lh.n == 0 && log.ld.n == 0)
+      log.opened = ticks;
+    iadd(&log.ld, &log.dx, b->blockno);
   }
   release(&log.lock);
 }
 
+// Record that the running transaction frees block blockno.
+// Its ordered data blocks are written home before its record,
+// so until it is sealed, blockno must not become one of them
+// (see log_isfreed()).  Nor may it become metadata: it may be
+// ordered data of the sealed transaction, which write_ordered()
+// skips once the block is logged.  Those of the next
+// transaction are written after this one's record, and the
+// sealed one's before the next is sealed, so sealing is enough.
+void
+log_freed(uint blockno)
+{
+  uint i = blockno / 8;
+
+  if (i >= NFREED)
+    panic("log_freed");
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_freed outside of trans");
+  log.freed[i] |= 1 << (blockno % 8);
+  if (log.fhi == 0 || i < log.flo)
+    log.flo = i;
+  if (i + 1 > log.fhi)
+    log.fhi = i + 1;
+  release(&log.lock);
+}
+
+// Was block blockno freed by the running transaction?
+// If so, it can't be allocated yet.
+int
+log_isfreed(uint blockno)
+{
+  int r;
+
+  if (blockno / 8 >= NFREED)
+    return 0;
+  acquire(&log.lock);
+  r = (log.freed[blockno / 8] >> (blockno % 8)) & 1;
+  release(&log.lock);
+  return r;
+}
+
+// Is block blockno part of the running transaction, logged
+// or as ordered data?  For subsystems that need to know
+// whether a block is dirty in the running transaction.
+int
+log_inrunning(uint blockno)
+{
+  int r;
+
+  acquire(&log.lock);
+  r = ifind(&log.lh, &log.lx, blockno) >= 0 ||
+      ifind(&log.ld, &log.dx, blockno) >= 0;
+  release(&log.lock);
+  return r;
+}
@@ -27,6 +27,7 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();
+    bstatinit();     // buffer cache statistics device
     snapshot_init();      // file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
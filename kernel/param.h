@@ -6,13 +6,16 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // initial size of the i-node table
+#define NINODEMAX  1024  // max size of the i-node table (grows into free memory)
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*3)  // default data blocks in on-disk log (mkfs -l)
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define NBUFMAX      2048  // max size of disk block cache (grows into free memory)
+#define NBATCH       64    // max blocks per breadn() or bwriten()
 #ifdef LAB_FS
 #define FSSIZE       200000  // size of file system in blocks
 #else
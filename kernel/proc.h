@@ -106,4 +106,7 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kthread)(void);       // Body of a kernel thread, else 0
+  int logres;                  // Log blocks reserved by begin_opn()
+  int datares;                 // Ordered data blocks reserved by begin_opn()
 };
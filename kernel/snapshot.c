@@ -11,6 +11,13 @@
 #include "fs.h"
 #include "buf.h"
 
+// Blocks held by one page-sized backup buffer.
+#define SNAP_BPP (PGSIZE / BSIZE)
+
+// Constants for the word-at-a-time block checksum (FNV-1a 64-bit).
+#define CSUM_SEED  0xcbf29ce484222325ULL
+#define CSUM_PRIME 0x100000001b3ULL
+
 // Complete snapshot structure for Phase 2, 3 & 4
 struct snapshot {
     int valid;              // Is this snapshot valid?
@@ -39,6 +46,12 @@ struct snapshot {
     char *bitmap_backup;          // Backup of free block bitmap
     uint bitmap_blocks;           // Number of bitmap blocks
     
+    // Per-block checksums of every captured block
+    uint64 inode_csum[SNAP_BPP];
+    uint64 dir_csum[SNAP_BPP];
+    uint64 file_csum[SNAP_BPP];
+    uint64 bitmap_csum[SNAP_BPP];
+    
     char label[32];        // Snapshot label
 };
 
@@ -80,12 +93,93 @@ calc_bitmap_blocks(uint nblocks)
     return (nblocks + BPB - 1) / BPB;  // BPB = bits per block
 }
 
+// Helper function: Number of blocks actually held by a one-page backup
+static uint
+backup_blocks(uint nblocks)
+{
+    return nblocks < SNAP_BPP ? nblocks : SNAP_BPP;
+}
+
+// Checksum one BSIZE block, a 64-bit word at a time.
+// Four independent lanes keep the multiplier pipelined instead of
+// serialising every word on the previous product; the lanes are
+// folded together at the end.
+static uint64
+block_csum(const char *data)
+{
+    const uint64 *w = (const uint64*)data;
+    uint64 a = CSUM_SEED, b = CSUM_SEED ^ 1, c = CSUM_SEED ^ 2, d = CSUM_SEED ^ 3;
+    
+    for (int i = 0; i < BSIZE / sizeof(uint64); i += 4) {
+        a = (a ^ w[i]) * CSUM_PRIME;
+        b = (b ^ w[i+1]) * CSUM_PRIME;
+        c = (c ^ w[i+2]) * CSUM_PRIME;
+        d = (d ^ w[i+3]) * CSUM_PRIME;
+    }
+    
+    a = (a ^ b) * CSUM_PRIME;
+    a = (a ^ c) * CSUM_PRIME;
+    a = (a ^ d) * CSUM_PRIME;
+    return a ^ (a >> 32);
+}
+
+// Helper function: Checksum nblocks consecutive blocks of a backup
+static void
+csum_backup(const char *backup, uint nblocks, uint64 *csum)
+{
+    for (uint b = 0; b < nblocks; b++)
+        csum[b] = block_csum(backup + b * BSIZE);
+}
+
+// Helper function: Recompute checksums of a backup region.
+// Returns the number of blocks whose checksum no longer matches.
+static int
+verify_backup(char *what, const char *backup, uint nblocks, uint64 *csum)
+{
+    int bad = 0;
+    
+    if (nblocks > 0 && !backup)
+        return nblocks;
+    
+    for (uint b = 0; b < nblocks; b++) {
+        if (block_csum(backup + b * BSIZE) != csum[b]) {
+            printf("snapverify: %s block %d corrupted\n", what, b);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Verify every captured block against the checksum taken at snapshot time.
+// Returns the number of corrupted blocks.
+static int
+verify_snapshot(void)
+{
+    int bad = 0;
+    
+    bad += verify_backup("inode", (char*)current_snapshot.inode_backup,
+                         backup_blocks(current_snapshot.inode_blocks),
+                         current_snapshot.inode_csum);
+    bad += verify_backup("directory", current_snapshot.dir_data_backup,
+                         current_snapshot.dir_block_count,
+                         current_snapshot.dir_csum);
+    bad += verify_backup("file", current_snapshot.file_data_backup,
+                         current_snapshot.file_block_count,
+                         current_snapshot.file_csum);
+    bad += verify_backup("bitmap", current_snapshot.bitmap_backup,
+                         backup_blocks(current_snapshot.bitmap_blocks),
+                         current_snapshot.bitmap_csum);
+    return bad;
+}
+
 // Helper function to invalidate inode cache
+// Unused inodes stay cached with their contents, which the
+// restore has just overwritten on disk.
 static void
 invalidate_inode_cache(void)
 {
     printf("Invalidating inode cache\n");
-    // Simple approach - let xv6 naturally refresh inodes as needed
+    iinval(ROOTDEV);
 }
 
 // Phase 2: Save inode table
@@ -128,6 +222,103 @@ save_inode_table(struct superblock *sb)
     return 0;
 }
 
+// A page-sized backup of data blocks being filled by a walker.
+struct backup {
+    uint *map;      // block numbers backed up
+    char *data;     // their contents
+    uint count;     // blocks backed up so far
+    uint size;      // bytes of data used
+    int direct;     // read past the buffer cache
+    char *what;     // "file" or "directory", for messages
+};
+
+// Back up data block addr.  Returns -1 if the backup is full.
+static int
+backup_block(struct backup *bk, uint addr)
+{
+    if (bk->count >= PGSIZE/sizeof(uint) || bk->size + BSIZE > PGSIZE)
+        return -1;
+
+    bk->map[bk->count] = addr;
+    if (bk->direct) {
+        // File contents won't be reread, so copy them
+        // straight into the backup page, past the cache
+        bread_direct(ROOTDEV, addr, (uchar*)bk->data + bk->size);
+    } else {
+        struct buf *data_bp = bread(ROOTDEV, addr);
+        memmove(bk->data + bk->size, data_bp->data, BSIZE);
+        brelse(data_bp);
+    }
+    bk->size += BSIZE;
+    bk->count++;
+    printf("  Backed up %s block %d\n", bk->what, addr);
+    return 0;
+}
+
+// Back up the data blocks under indirect block addr, which has
+// level-1 more levels of indirect blocks below it.
+static int
+backup_indirect(struct backup *bk, uint addr, int level)
+{
+    struct buf *indirect_bp = bread(ROOTDEV, addr);
+    uint *indirect_addrs = (uint*)indirect_bp->data;
+    int r = 0;
+
+    printf("  Found level %d indirect block %d\n", level, addr);
+    for (uint k = 0; k < NINDIRECT && indirect_addrs[k] != 0 && r == 0; k++) {
+        if (level > 1)
+            r = backup_indirect(bk, indirect_addrs[k], level - 1);
+        else
+            r = backup_block(bk, indirect_addrs[k]);
+    }
+    brelse(indirect_bp);
+    return r;
+}
+
+// Back up the blocks of the runs of the ne extents at e.
+static int
+backup_extents(struct backup *bk, struct extent *e, int ne)
+{
+    for (int i = 0; i < ne && e[i].len != 0; i++) {
+        for (uint k = 0; k < e[i].len; k++) {
+            if (backup_block(bk, e[i].start + k) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Back up the data blocks of disk inode di: its extents' runs,
+// or else the direct ones and then those under the single,
+// double and triple indirect blocks.  Returns -1 if the backup
+// fills up.
+static int
+backup_inode(struct backup *bk, struct dinode *di)
+{
+    if (di->flags & DI_EXTENT) {
+        if (backup_extents(bk, (struct extent*)di->addrs, NIEXTENT) < 0)
+            return -1;
+        if (di->addrs[NDIRECT + 2] != 0) {
+            struct buf *ext_bp = bread(ROOTDEV, di->addrs[NDIRECT + 2]);
+            int r = backup_extents(bk, (struct extent*)ext_bp->data, NBEXTENT);
+            brelse(ext_bp);
+            return r;
+        }
+        return 0;
+    }
+
+    for (int j = 0; j < NDIRECT && di->addrs[j] != 0; j++) {
+        if (backup_block(bk, di->addrs[j]) < 0)
+            return -1;
+    }
+    for (int level = 1; level <= 3; level++) {
+        uint addr = di->addrs[NDIRECT + level - 1];
+        if (addr != 0 && backup_indirect(bk, addr, level) < 0)
+            return -1;
+    }
+    return 0;
+}
+
 // Phase 3: Save directory data blocks
 static int
 save_directory_data(struct superblock *sb)
@@ -147,12 +338,14 @@ save_directory_data(struct superblock *sb)
         return -1;
     }
     
-    uint dir_blocks_found = 0;
-    uint data_offset = 0;
-    uint *block_map = (uint*)current_snapshot.dir_block_map;
+    struct backup bk = {
+        (uint*)current_snapshot.dir_block_map,
+        current_snapshot.dir_data_backup, 0, 0, 0, "directory"
+    };
+    int full = 0;
     
     struct buf *inode_bp;
-    for (uint inode_block = 0; inode_block < current_snapshot.inode_blocks; inode_block++) {
+    for (uint inode_block = 0; inode_block < current_snapshot.inode_blocks && !full; inode_block++) {
         inode_bp = bread(ROOTDEV, sb->inodestart + inode_block);
         struct dinode *dinodes = (struct dinode*)inode_bp->data;
         
@@ -164,42 +357,21 @@ save_directory_data(struct superblock *sb)
                 printf("Found directory inode %d, size %d\n", 
                        inode_block * inodes_per_block + i, di->size);
                 
-                for (int j = 0; j < NDIRECT && di->addrs[j] != 0; j++) {
-                    if (dir_blocks_found >= PGSIZE/sizeof(uint)) {
-                        printf("Too many directory blocks, truncating\n");
-                        break;
-                    }
-                    
-                    uint block_addr = di->addrs[j];
-                    block_map[dir_blocks_found] = block_addr;
-                    
-                    struct buf *data_bp = bread(ROOTDEV, block_addr);
-                    if (data_offset + BSIZE <= PGSIZE) {
-                        memmove(current_snapshot.dir_data_backup + data_offset, 
-                               data_bp->data, BSIZE);
-                        data_offset += BSIZE;
-                        dir_blocks_found++;
-                        printf("  Backed up directory block %d\n", block_addr);
-                    }
-                    brelse(data_bp);
-                    
-                    if (data_offset + BSIZE > PGSIZE) {
-                        printf("Directory data backup full\n");
-                        break;
-                    }
+                if (backup_inode(&bk, di) < 0) {
+                    printf("Directory data backup full\n");
+                    full = 1;
+                    break;
                 }
             }
         }
         brelse(inode_bp);
-        
-        if (data_offset + BSIZE > PGSIZE) break;
     }
     
-    current_snapshot.dir_block_count = dir_blocks_found;
-    current_snapshot.dir_data_size = data_offset;
+    current_snapshot.dir_block_count = bk.count;
+    current_snapshot.dir_data_size = bk.size;
     
     printf("Saved %d directory blocks (%d bytes)\n", 
-           dir_blocks_found, data_offset);
+           bk.count, bk.size);
     return 0;
 }
 
@@ -222,12 +394,14 @@ save_file_data(struct superblock *sb)
         return -1;
     }
     
-    uint file_blocks_found = 0;
-    uint data_offset = 0;
-    uint *block_map = (uint*)current_snapshot.file_block_map;
+    struct backup bk = {
+        (uint*)current_snapshot.file_block_map,
+        current_snapshot.file_data_backup, 0, 0, 1, "file"
+    };
+    int full = 0;
     
     struct buf *inode_bp;
-    for (uint inode_block = 0; inode_block < current_snapshot.inode_blocks; inode_block++) {
+    for (uint inode_block = 0; inode_block < current_snapshot.inode_blocks && !full; inode_block++) {
         inode_bp = bread(ROOTDEV, sb->inodestart + inode_block);
         struct dinode *dinodes = (struct dinode*)inode_bp->data;
         
@@ -240,70 +414,21 @@ save_file_data(struct superblock *sb)
                 printf("Found file inode %d, size %d\n", 
                        inode_block * inodes_per_block + i, di->size);
                 
-                // Save file's direct blocks
-                for (int j = 0; j < NDIRECT && di->addrs[j] != 0; j++) {
-                    if (file_blocks_found >= PGSIZE/sizeof(uint)) {
-                        printf("Too many file blocks, truncating\n");
-                        break;
-                    }
-                    
-                    uint block_addr = di->addrs[j];
-                    block_map[file_blocks_found] = block_addr;
-                    
-                    struct buf *data_bp = bread(ROOTDEV, block_addr);
-                    if (data_offset + BSIZE <= PGSIZE) {
-                        memmove(current_snapshot.file_data_backup + data_offset, 
-                               data_bp->data, BSIZE);
-                        data_offset += BSIZE;
-                        file_blocks_found++;
-                        printf("  Backed up file block %d\n", block_addr);
-                    }
-                    brelse(data_bp);
-                    
-                    if (data_offset + BSIZE > PGSIZE) {
-                        printf("File data backup full\n");
-                        break;
-                    }
-                }
-                
-                // Handle indirect block if present
-                if (di->addrs[NDIRECT] != 0 && data_offset + BSIZE <= PGSIZE) {
-                    printf("  Found indirect block %d\n", di->addrs[NDIRECT]);
-                    
-                    struct buf *indirect_bp = bread(ROOTDEV, di->addrs[NDIRECT]);
-                    uint *indirect_addrs = (uint*)indirect_bp->data;
-                    
-                    for (uint k = 0; k < NINDIRECT && indirect_addrs[k] != 0; k++) {
-                        if (file_blocks_found >= PGSIZE/sizeof(uint) || 
-                            data_offset + BSIZE > PGSIZE) {
-                            break;
-                        }
-                        
-                        uint block_addr = indirect_addrs[k];
-                        block_map[file_blocks_found] = block_addr;
-                        
-                        struct buf *data_bp = bread(ROOTDEV, block_addr);
-                        memmove(current_snapshot.file_data_backup + data_offset, 
-                               data_bp->data, BSIZE);
-                        data_offset += BSIZE;
-                        file_blocks_found++;
-                        printf("    Backed up indirect file block %d\n", block_addr);
-                        brelse(data_bp);
-                    }
-                    brelse(indirect_bp);
+                if (backup_inode(&bk, di) < 0) {
+                    printf("File data backup full\n");
+                    full = 1;
+                    break;
                 }
             }
         }
         brelse(inode_bp);
-        
-        if (data_offset + BSIZE > PGSIZE) break;
     }
     
-    current_snapshot.file_block_count = file_blocks_found;
-    current_snapshot.file_data_size = data_offset;
+    current_snapshot.file_block_count = bk.count;
+    current_snapshot.file_data_size = bk.size;
     
     printf("Saved %d file blocks (%d bytes)\n", 
-           file_blocks_found, data_offset);
+           bk.count, bk.size);
     return 0;
 }
 
@@ -377,6 +502,9 @@ restore_inode_table(void)
         }
     }
     
+    // The free-inode counts describe the old inode table
+    isuminit(ROOTDEV);
+    
     printf("Inode table restored successfully\n");
     return 0;
 }
@@ -472,6 +600,9 @@ restore_bitmap(void)
         }
     }
     
+    // The allocator's free counts describe the old bitmap
+    bsuminit(ROOTDEV);
+    
     printf("Bitmap restored successfully\n");
     return 0;
 }
@@ -548,6 +679,20 @@ sys_snap(void)
         return -1;
     }
     
+    // Checksum every captured block
+    csum_backup((char*)current_snapshot.inode_backup,
+                backup_blocks(current_snapshot.inode_blocks),
+                current_snapshot.inode_csum);
+    csum_backup(current_snapshot.dir_data_backup,
+                current_snapshot.dir_block_count,
+                current_snapshot.dir_csum);
+    csum_backup(current_snapshot.file_data_backup,
+                current_snapshot.file_block_count,
+                current_snapshot.file_csum);
+    csum_backup(current_snapshot.bitmap_backup,
+                backup_blocks(current_snapshot.bitmap_blocks),
+                current_snapshot.bitmap_csum);
+    
     // Mark snapshot as valid
     current_snapshot.valid = 1;
     strncpy(current_snapshot.label, "Complete_Snapshot", 31);
@@ -567,6 +712,13 @@ sys_restore(void)
         return -1;
     }
     
+    // Refuse to write back a payload that has been corrupted in memory
+    if (verify_snapshot() != 0) {
+        printf("Snapshot '%s' is corrupted, refusing to restore\n",
+               current_snapshot.label);
+        return -1;
+    }
+    
     printf("Restoring snapshot '%s'\n", current_snapshot.label);
     printf("Original filesystem: %d blocks, %d inodes\n",
            current_snapshot.nblocks, current_snapshot.ninodes);
@@ -608,6 +760,28 @@ sys_restore(void)
     return 0;
 }
 
+// Recompute the checksum of every captured block of snapshot id.
+// Only one snapshot is kept, so id 0 is the only valid id.
+// Returns 0 if the snapshot is intact, -1 otherwise.
+uint64
+sys_snapverify(void)
+{
+    int id;
+    
+    argint(0, &id);
+    if (id != 0 || !current_snapshot.valid) {
+        printf("snapverify: no snapshot %d\n", id);
+        return -1;
+    }
+    
+    int bad = verify_snapshot();
+    if (bad != 0) {
+        printf("snapverify: %d corrupted blocks\n", bad);
+        return -1;
+    }
+    return 0;
+}
+
 // Helper function to display snapshot info (for debugging)
 void
 snapshot_info(void)
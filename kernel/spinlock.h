@@ -7,6 +7,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  // For statistics:
+  uint64 n;          // times acquired
+  uint64 nts;        // test-and-sets that found it held
 };
 
 #endif // SPINLOCK_H
@@ -103,6 +103,12 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_snap(void);
 extern uint64 sys_restore(void);
+extern uint64 sys_snapverify(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_fruns(void);
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
 static uint64 (*syscalls[])(void) = {
@@ -129,6 +135,12 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_snap]    sys_snap,
 [SYS_restore] sys_restore,
+[SYS_snapverify] sys_snapverify,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_lseek]   sys_lseek,
+[SYS_fallocate] sys_fallocate,
+[SYS_fruns]   sys_fruns,
 };
 
 void
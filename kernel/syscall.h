@@ -21,4 +21,10 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_snap     22
-#define SYS_restore  23
\ No newline at end of file
+#define SYS_restore  23
+#define SYS_snapverify 24
+#define SYS_fsync  25
+#define SYS_fdatasync 26
+#define SYS_lseek  27
+#define SYS_fallocate 28
+#define SYS_fruns  29
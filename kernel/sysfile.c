@@ -119,6 +119,62 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 0);
+}
+
+uint64
+sys_fdatasync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 1);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len < 0)
+    return -1;
+  return fileallocate(f, off, len);
+}
+
+uint64
+sys_fruns(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileruns(f);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -243,7 +299,7 @@ bad:
 }
 
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(char *path, short type, short major, short minor, char flags)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
@@ -271,6 +327,7 @@ create(char *path, short type, short major, short minor)
   ip->major = major;
   ip->minor = minor;
   ip->nlink = 1;
+  ip->flags = flags;
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
@@ -317,7 +374,7 @@ sys_open(void)
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, T_FILE, 0, 0, (omode & O_EXTENT) ? DI_EXTENT : 0);
     if(ip == 0){
       end_op();
       return -1;
@@ -355,13 +412,23 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ra_off = 0;
+    f->ra_win = 0;
+    f->direct = (omode & O_DIRECT) != 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
+    // a transaction at a time (see itrunc()), letting other
+    // operations at ip in between.
+    while(!itrunc(ip)){
+      iunlock(ip);
+      end_op();
+      begin_op();
+      ilock(ip);
+    }
   }
 
   iunlock(ip);
@@ -377,7 +444,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -397,7 +464,7 @@ sys_mknod(void)
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
+     (ip = create(path, T_DEVICE, major, minor, 0)) == 0){
     end_op();
     return -1;
   }
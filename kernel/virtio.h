@@ -47,7 +47,11 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 64
+
+// most blocks merged into one request; each takes a descriptor,
+// plus one for the header and one for the status.
+#define MAXRUN 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
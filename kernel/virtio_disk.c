@@ -46,8 +46,11 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first of n buffers, linked through ionext
+    int n;
     char status;
+    char async;    // complete with bdone() rather than wakeup()
+    uint64 start;  // r_time() at submission, for statistics
   } info[NUM];
 
   // disk command headers.
@@ -196,12 +199,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +215,31 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// queue one request to read or write the n buffers starting at
+// b and linked through ionext, which must hold consecutive blocks.
+// caller must hold disk.vdisk_lock; may sleep for descriptors.
+static void
+virtio_disk_submit(struct buf *b, int n, int write, int async)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
+  if(n < 1 || n > MAXRUN)
+    panic("virtio_disk_submit");
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then the data, then a
+  // 1-byte status result. the data may be split over several
+  // descriptors, so a run of blocks takes one per buffer.
 
-  // allocate the three descriptors.
-  int idx[3];
+  int idx[MAXRUN+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +256,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  struct buf *p = b;
+  for(int i = 1; i <= n; i++, p = p->ionext){
+    disk.desc[idx[i]].addr = (uint64) p->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads p->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes p->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+    p->disk = 1;
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
   disk.info[idx[0]].b = b;
+  disk.info[idx[0]].n = n;
+  disk.info[idx[0]].async = async;
+  disk.info[idx[0]].start = r_time();
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -279,14 +292,59 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+
+  b->ionext = 0;
+  virtio_disk_submit(b, 1, write, 0);
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// start reading or writing b and return without waiting.
+// b must be locked; virtio_disk_intr() hands it to bdone()
+// when the transfer finishes.
+void
+virtio_disk_rw_async(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+  b->ionext = 0;
+  virtio_disk_submit(b, 1, write, 1);
+  release(&disk.vdisk_lock);
+}
+
+// read or write the n locked buffers in bv, which must be sorted
+// by block number. runs of consecutive blocks go to the device as
+// single requests; all requests are queued before waiting for any.
+void
+virtio_disk_rwv(struct buf **bv, int n, int write)
+{
+  int i, j;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && j-i < MAXRUN &&
+          bv[j]->dev == bv[j-1]->dev &&
+          bv[j]->blockno == bv[j-1]->blockno + 1; j++)
+      bv[j-1]->ionext = bv[j];
+    bv[j-1]->ionext = 0;
+    virtio_disk_submit(bv[i], j-i, write, 0);
+  }
+
+  for(i = 0; i < n; i++){
+    while(bv[i]->disk == 1)
+      sleep(bv[i], &disk.vdisk_lock);
+  }
 
   release(&disk.vdisk_lock);
 }
@@ -317,8 +375,22 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int n = disk.info[id].n;
+    int async = disk.info[id].async;
+    bstat_disk(disk.ops[id].type == VIRTIO_BLK_T_OUT,
+               r_time() - disk.info[id].start);
+    disk.info[id].b = 0;
+    free_chain(id);
+
+    for(; n > 0; n--){
+      struct buf *nb = b->ionext;
+      b->disk = 0;   // disk is done with buf
+      if(async)
+        bdone(b);
+      else
+        wakeup(b);
+      b = nb;
+    }
 
     disk.used_idx += 1;
   }
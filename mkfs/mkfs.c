@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+2;  // journal superblock, record header, LOGSIZE blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -77,8 +77,14 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+
+  if(argc < 2 || nlog < MAXOPBLOCKS+2){
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
     exit(1);
   }
 
@@ -226,7 +232,7 @@ ialloc(ushort type)
   struct dinode din;
 
   bzero(&din, sizeof(din));
-  din.type = xshort(type);
+  din.type = type;
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -237,16 +243,19 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BPB);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used <= nbitmap*BPB);
+  // large files in the image can fill more than one bitmap block.
+  for(b = 0; b * BPB < used; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b*BPB + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b);
+    wsect(sb.bmapstart + b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -259,7 +268,8 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, bn, span;
+  int level;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -273,15 +283,28 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      // find the tree of indirect blocks holding fbn, as bmap()
+      // does, and walk down it.
+      bn = fbn - NDIRECT;
+      span = NINDIRECT;
+      for(level = 1; bn >= span; level++){
+        bn -= span;
+        span *= NINDIRECT;
+      }
+      if(xint(din.addrs[NDIRECT+level-1]) == 0){
+        din.addrs[NDIRECT+level-1] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = xint(din.addrs[NDIRECT+level-1]);
+      for(; level > 0; level--){
+        span /= NINDIRECT;
+        rsect(x, (char*)indirect);
+        if(indirect[bn / span] == 0){
+          indirect[bn / span] = xint(freeblock++);
+          wsect(x, (char*)indirect);
+        }
+        x = xint(indirect[bn / span]);
+        bn %= span;
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
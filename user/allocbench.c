@@ -0,0 +1,117 @@
+// Measure the cost of block allocation as the disk fills.
+//
+// Times NALLOC one-block appends, each of which allocates a
+// block, on the file system as it is; then fills the disk to
+// the given percentage of FSSIZE with filler files and times
+// them again.  balloc() used to scan the bitmap from block 0
+// bit by bit, so its cost grew with the used part of the disk.
+//
+// Usage: allocbench [percent-full]
+// Needs a large file system (make LAB=fs), and the default of
+// 90% of FSSIZE=200000 takes a while to fill.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NALLOC  2000
+#define CHUNK   16       // blocks per filler write()
+#define FILLBLK 16384    // blocks per filler file
+
+char buf[CHUNK*BSIZE];
+
+// Time NALLOC one-block appends to a new file.
+int
+timealloc(void)
+{
+  int fd, i, start, t;
+
+  if((fd = open("ab.tmp", O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    printf("allocbench: create failed\n");
+    exit(1);
+  }
+  start = uptime();
+  for(i = 0; i < NALLOC; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("allocbench: write failed at block %d\n", i);
+      exit(1);
+    }
+  }
+  t = uptime() - start;
+  close(fd);
+  unlink("ab.tmp");
+  return t;
+}
+
+// Write about nblocks blocks into filler files; return how many.
+int
+fill(int nblocks)
+{
+  char name[8];
+  int f, b, fd, n, done;
+
+  done = 0;
+  for(f = 0; done < nblocks && f < 100; f++){
+    name[0] = 'f';
+    name[1] = 'i';
+    name[2] = '0' + f / 10;
+    name[3] = '0' + f % 10;
+    name[4] = 0;
+    if((fd = open(name, O_CREATE | O_TRUNC | O_WRONLY | O_EXTENT)) < 0)
+      break;
+    for(b = 0; b < FILLBLK && done < nblocks; b += n, done += n){
+      n = CHUNK;
+      if(write(fd, buf, n*BSIZE) != n*BSIZE)
+        break;
+    }
+    close(fd);
+    if(b < FILLBLK && done < nblocks)
+      break;  // disk full
+  }
+  return done;
+}
+
+void
+unfill(void)
+{
+  char name[8];
+  int f;
+
+  for(f = 0; f < 100; f++){
+    name[0] = 'f';
+    name[1] = 'i';
+    name[2] = '0' + f / 10;
+    name[3] = '0' + f % 10;
+    name[4] = 0;
+    unlink(name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pct, n, t0, t1;
+
+  pct = 90;
+  if(argc > 1)
+    pct = atoi(argv[1]);
+  if(pct < 0 || pct > 99){
+    printf("allocbench: bad percentage %d\n", pct);
+    exit(1);
+  }
+  memset(buf, 'a', sizeof(buf));
+
+  t0 = timealloc();
+  printf("allocbench: %d allocations as is: %d ticks\n", NALLOC, t0);
+
+  n = fill(FSSIZE / 100 * pct);
+  printf("allocbench: filled %d blocks\n", n);
+  t1 = timealloc();
+  printf("allocbench: %d allocations %d%% full: %d ticks\n", NALLOC, pct, t1);
+
+  unfill();
+  exit(0);
+}
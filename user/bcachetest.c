@@ -0,0 +1,156 @@
+// Stress the buffer cache from several processes at once.
+// Each child rereads its own small file, so nearly every bread()
+// hits in the cache and the run time is dominated by bcache locking.
+// Compare the per-read cost with one child against NCHILD children;
+// run with CPUS=4 or more for the children to land on separate harts.
+// Each run also reports how often the bucket locks and bcache.lock
+// were acquired and how many times acquire() spun on them.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/bstat.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NBLK   4      // blocks per file, small enough to stay cached
+#define ROUNDS 500
+
+char buf[BSIZE];
+int statfd;
+
+void
+mkfile(int i)
+{
+  char path[] = "bctest0";
+  int fd, b;
+
+  path[6] += i;
+  unlink(path);
+  fd = open(path, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("bcachetest: create %s failed\n", path);
+    exit(1);
+  }
+  memset(buf, 'a' + i, sizeof(buf));
+  for(b = 0; b < NBLK; b++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bcachetest: write %s failed\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+reader(int i)
+{
+  char path[] = "bctest0";
+  int fd, r, b;
+
+  path[6] += i;
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(path, O_RDONLY);
+    if(fd < 0){
+      printf("bcachetest: open %s failed\n", path);
+      exit(1);
+    }
+    for(b = 0; b < NBLK; b++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' + i){
+        printf("bcachetest: read %s failed\n", path);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+void
+sample(struct bstat *st)
+{
+  if(read(statfd, st, sizeof(*st)) != sizeof(*st)){
+    printf("bcachetest: read bstat failed\n");
+    exit(1);
+  }
+}
+
+// Print the lock counts from before and after a run.
+void
+lockstats(struct bstat *b, struct bstat *a)
+{
+  printf("bcachetest:   bucket locks: %ld acquires, %ld spins (before %ld/%ld, after %ld/%ld)\n",
+         a->bktacq - b->bktacq, a->bktspin - b->bktspin,
+         b->bktacq, b->bktspin, a->bktacq, a->bktspin);
+  printf("bcachetest:   bcache.lock: %ld acquires, %ld spins (before %ld/%ld, after %ld/%ld)\n",
+         a->bcacheacq - b->bcacheacq, a->bcachespin - b->bcachespin,
+         b->bcacheacq, b->bcachespin, a->bcacheacq, a->bcachespin);
+}
+
+// Run n readers in parallel; return elapsed ticks.
+int
+run(int n)
+{
+  int i, start, ticks, xstatus, failed;
+  struct bstat before, after;
+
+  failed = 0;
+  sample(&before);
+  start = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      reader(i);
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  if(failed){
+    printf("bcachetest: FAILED\n");
+    exit(1);
+  }
+  ticks = uptime() - start;
+  sample(&after);
+  printf("bcachetest: %d reader%s:\n", n, n == 1 ? "" : "s");
+  lockstats(&before, &after);
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, t1, tn;
+
+  if((statfd = open("bstat", O_RDONLY)) < 0){
+    printf("bcachetest: cannot open bstat\n");
+    exit(1);
+  }
+  printf("bcachetest: %d children, %d rounds of %d blocks\n",
+         NCHILD, ROUNDS, NBLK);
+  for(i = 0; i < NCHILD; i++)
+    mkfile(i);
+
+  t1 = run(1);
+  tn = run(NCHILD);
+  printf("bcachetest: 1 reader: %d ticks for %d reads\n", t1, ROUNDS*NBLK);
+  printf("bcachetest: %d readers: %d ticks for %d reads\n",
+         NCHILD, tn, NCHILD*ROUNDS*NBLK);
+  if(t1 > 0)
+    printf("bcachetest: parallel slowdown %d%% (ideal 100%% with >= %d harts)\n",
+           tn * 100 / t1, NCHILD);
+
+  for(i = 0; i < NCHILD; i++){
+    char path[] = "bctest0";
+    path[6] += i;
+    unlink(path);
+  }
+  printf("bcachetest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,134 @@
+// Measure access to a multi-megabyte file, whose blocks are
+// reached through double-indirect (past 266 KB) and
+// triple-indirect (past 64 MB) blocks.
+//
+// Writes the file sequentially, reads it back sequentially,
+// then does NRAND reads and NRAND writes of single blocks at
+// random offsets.  Each block carries its block number, which
+// every read checks.  With "extent", the file is mapped by
+// extents (O_EXTENT) rather than indirect blocks.
+//
+// Usage: bigbench [megabytes [extent]]
+// Needs a large file system (make LAB=fs).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define CHUNK   16      // blocks per sequential read() or write()
+#define NRAND   1024
+
+char buf[CHUNK*BSIZE];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+report(char *what, int kb, int t)
+{
+  printf("bigbench: %s: %d KB in %d ticks", what, kb, t);
+  if(t > 0)
+    printf(", %d KB/tick", kb / t);
+  printf("\n");
+}
+
+// Check that buf holds blocks bn..bn+n-1.
+void
+check(int bn, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(((int*)(buf + i*BSIZE))[0] != bn + i){
+      printf("bigbench: block %d holds %d\n", bn + i,
+             ((int*)(buf + i*BSIZE))[0]);
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, nblk, fd, bn, i, n, start, omode;
+
+  mb = 8;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1 || mb > 4095){
+    printf("bigbench: bad size %d\n", mb);
+    exit(1);
+  }
+  omode = O_CREATE | O_RDWR;
+  if(argc > 2 && strcmp(argv[2], "extent") == 0)
+    omode |= O_EXTENT;
+  nblk = mb * 1024 * 1024 / BSIZE;
+  memset(buf, 'b', sizeof(buf));
+
+  unlink("bigbench.tmp");
+  if((fd = open("bigbench.tmp", omode)) < 0){
+    printf("bigbench: create failed\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(bn = 0; bn < nblk; bn += n){
+    n = nblk - bn < CHUNK ? nblk - bn : CHUNK;
+    for(i = 0; i < n; i++)
+      ((int*)(buf + i*BSIZE))[0] = bn + i;
+    if(write(fd, buf, n*BSIZE) != n*BSIZE){
+      printf("bigbench: write failed at block %d\n", bn);
+      exit(1);
+    }
+  }
+  fsync(fd);
+  report("sequential write", mb * 1024, uptime() - start);
+
+  start = uptime();
+  lseek(fd, 0, SEEK_SET);
+  for(bn = 0; bn < nblk; bn += n){
+    n = nblk - bn < CHUNK ? nblk - bn : CHUNK;
+    if(read(fd, buf, n*BSIZE) != n*BSIZE){
+      printf("bigbench: read failed at block %d\n", bn);
+      exit(1);
+    }
+    check(bn, n);
+  }
+  report("sequential read", mb * 1024, uptime() - start);
+
+  start = uptime();
+  for(i = 0; i < NRAND; i++){
+    bn = rnd() % nblk;
+    if(lseek(fd, bn*BSIZE, SEEK_SET) < 0 ||
+       read(fd, buf, BSIZE) != BSIZE){
+      printf("bigbench: random read failed at block %d\n", bn);
+      exit(1);
+    }
+    check(bn, 1);
+  }
+  report("random read", NRAND * BSIZE / 1024, uptime() - start);
+
+  start = uptime();
+  for(i = 0; i < NRAND; i++){
+    bn = rnd() % nblk;
+    ((int*)buf)[0] = bn;
+    if(lseek(fd, bn*BSIZE, SEEK_SET) < 0 ||
+       write(fd, buf, BSIZE) != BSIZE){
+      printf("bigbench: random write failed at block %d\n", bn);
+      exit(1);
+    }
+  }
+  fsync(fd);
+  report("random write", NRAND * BSIZE / 1024, uptime() - start);
+
+  close(fd);
+  unlink("bigbench.tmp");
+  exit(0);
+}
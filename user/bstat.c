@@ -0,0 +1,96 @@
+// bstat: report buffer cache and disk statistics, like vmstat.
+//
+//   bstat                 print totals since boot and the
+//                         histogram of disk request times
+//   bstat ticks [count]   print what changed every ticks clock
+//                         ticks, count times (default forever)
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/bstat.h"
+#include "user/user.h"
+
+int fd;
+
+void
+sample(struct bstat *st)
+{
+  if(read(fd, st, sizeof(*st)) != sizeof(*st)){
+    fprintf(2, "bstat: read failed\n");
+    exit(1);
+  }
+}
+
+// Print one line of counters; hit rate is in percent.
+void
+line(struct bstat *st)
+{
+  uint64 refs = st->hits + st->misses;
+  uint64 ios = st->reads + st->writes;
+
+  printf("%ld %ld %ld %ld %ld %ld %ld %ld %ld %ld\n",
+         st->nbuf, st->hits, st->misses,
+         refs ? st->hits * 100 / refs : 0,
+         st->evictions, st->lockwaits, st->bufwaits,
+         st->reads, st->writes,
+         ios ? st->waitus / ios : 0);
+}
+
+void
+header(void)
+{
+  printf("nbuf hits misses hit%% evict lockwait bufwait reads writes avg-us\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bstat prev, cur, d;
+  int interval, count, i;
+
+  if((fd = open("bstat", O_RDONLY)) < 0){
+    fprintf(2, "bstat: cannot open bstat\n");
+    exit(1);
+  }
+
+  if(argc < 2){
+    sample(&cur);
+    header();
+    line(&cur);
+    printf("disk request times:\n");
+    for(i = 0; i < NBSTATHIST; i++){
+      if(cur.waithist[i])
+        printf("  < %d us: %ld\n", 2 << i, cur.waithist[i]);
+    }
+    exit(0);
+  }
+
+  interval = atoi(argv[1]);
+  count = argc > 2 ? atoi(argv[2]) : -1;
+  if(interval <= 0){
+    fprintf(2, "usage: bstat [ticks [count]]\n");
+    exit(1);
+  }
+
+  header();
+  sample(&prev);
+  while(count != 0){
+    sleep(interval);
+    sample(&cur);
+    d.nbuf = cur.nbuf;
+    d.hits = cur.hits - prev.hits;
+    d.misses = cur.misses - prev.misses;
+    d.evictions = cur.evictions - prev.evictions;
+    d.lockwaits = cur.lockwaits - prev.lockwaits;
+    d.bufwaits = cur.bufwaits - prev.bufwaits;
+    d.reads = cur.reads - prev.reads;
+    d.writes = cur.writes - prev.writes;
+    d.waitus = cur.waitus - prev.waitus;
+    line(&d);
+    prev = cur;
+    if(count > 0)
+      count--;
+  }
+  exit(0);
+}
@@ -0,0 +1,124 @@
+// Measure file fragmentation and its cost to sequential reads.
+//
+// Writes NFILE files side by side, a block to each in turn,
+// the way several slowly growing logs would be written, then
+// reports how many runs of contiguous blocks each file ended
+// up in (fruns()) and times reading them back one after the
+// other, with the buffer cache flushed out by a large file
+// in between.
+//
+// The mode says how the files are written:
+//   open       kept open, so each has a reservation window
+//   reopen     reopened for every block, so none keeps its
+//              window: blocks interleave as without windows
+//   fallocate  kept open, with all their space allocated
+//              by fallocate() first
+//
+// Usage: fragbench [open | reopen | fallocate] [extent]
+// Needs a large file system (make LAB=fs).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NFILE   4
+#define NBLK    1024    // blocks per file
+#define FLUSH   2560    // blocks written to push the files out of the cache
+#define CHUNK   16      // blocks per sequential read()
+
+char buf[CHUNK*BSIZE];
+char name[NFILE][4] = { "fb0", "fb1", "fb2", "fb3" };
+
+int
+main(int argc, char *argv[])
+{
+  int fd[NFILE], i, b, omode, reopen, falloc, n, nrun, start, t;
+  struct stat st;
+
+  reopen = argc > 1 && strcmp(argv[1], "reopen") == 0;
+  falloc = argc > 1 && strcmp(argv[1], "fallocate") == 0;
+  omode = O_CREATE | O_RDWR;
+  if(argc > 2 && strcmp(argv[2], "extent") == 0)
+    omode |= O_EXTENT;
+  memset(buf, 'f', sizeof(buf));
+
+  for(i = 0; i < NFILE; i++){
+    if((fd[i] = open(name[i], omode | O_TRUNC)) < 0){
+      printf("fragbench: create %s failed\n", name[i]);
+      exit(1);
+    }
+    if(falloc && fallocate(fd[i], 0, NBLK*BSIZE) < 0){
+      printf("fragbench: fallocate failed\n");
+      exit(1);
+    }
+    if(reopen)
+      close(fd[i]);
+  }
+  for(b = 0; b < NBLK; b++){
+    for(i = 0; i < NFILE; i++){
+      if(reopen){
+        if((fd[i] = open(name[i], omode)) < 0 ||
+           lseek(fd[i], b*BSIZE, SEEK_SET) < 0){
+          printf("fragbench: reopen %s failed\n", name[i]);
+          exit(1);
+        }
+      }
+      if(write(fd[i], buf, BSIZE) != BSIZE){
+        printf("fragbench: write failed at block %d\n", b);
+        exit(1);
+      }
+      if(reopen)
+        close(fd[i]);
+    }
+  }
+
+  nrun = 0;
+  for(i = 0; i < NFILE; i++){
+    if(!reopen)
+      close(fd[i]);
+    if((fd[i] = open(name[i], O_RDONLY)) < 0 || fstat(fd[i], &st) < 0 ||
+       st.size != NBLK*BSIZE || (n = fruns(fd[i])) < 0){
+      printf("fragbench: %s has the wrong size\n", name[i]);
+      exit(1);
+    }
+    nrun += n;
+    close(fd[i]);
+  }
+  printf("fragbench: %d files of %d blocks in %d runs\n", NFILE, NBLK, nrun);
+
+  // read something else so the files must come from the disk.
+  if((fd[0] = open("fb.flush", O_CREATE | O_TRUNC | O_RDWR)) < 0){
+    printf("fragbench: create fb.flush failed\n");
+    exit(1);
+  }
+  for(b = 0; b < FLUSH; b += CHUNK)
+    write(fd[0], buf, sizeof(buf));
+  close(fd[0]);
+  unlink("fb.flush");
+
+  start = uptime();
+  for(i = 0; i < NFILE; i++){
+    if((fd[i] = open(name[i], O_RDONLY)) < 0){
+      printf("fragbench: open %s failed\n", name[i]);
+      exit(1);
+    }
+    for(b = 0; b < NBLK; b += CHUNK){
+      if(read(fd[i], buf, sizeof(buf)) != sizeof(buf)){
+        printf("fragbench: read failed at block %d\n", b);
+        exit(1);
+      }
+    }
+    close(fd[i]);
+  }
+  t = uptime() - start;
+  printf("fragbench: read %d KB back: %d ticks", NFILE*NBLK, t);
+  if(t > 0)
+    printf(", %d KB/tick", NFILE*NBLK / t);
+  printf("\n");
+
+  for(i = 0; i < NFILE; i++)
+    unlink(name[i]);
+  exit(0);
+}
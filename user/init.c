@@ -23,6 +23,8 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  mknod("bstat", BSTAT, 0);  // fails harmlessly if it exists
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
@@ -0,0 +1,73 @@
+// Measure large-file write throughput, which depends on how
+// much a single log transaction can hold.
+//
+// Each round writes a file of NBLK blocks with write() calls of
+// the given size, then removes it.  filewrite() splits a write
+// into chunks of up to half the log, each a transaction of its
+// own, so a bigger log (make NLOG=258 fs.img) means fewer and
+// larger commits.  Run it on images with different log sizes
+// and compare the rates.
+//
+// With "sync", each write is followed by fsync(), which commits
+// at once instead of at the end of the group-commit window.
+//
+// Usage: logbench [kb-per-write [sync]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLK    256     // blocks per file
+#define ROUNDS  8
+
+int
+main(int argc, char *argv[])
+{
+  int kb, dosync, n, r, i, fd, start, t;
+  char *buf;
+
+  kb = 64;
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  dosync = argc > 2 && strcmp(argv[2], "sync") == 0;
+  if(kb < 1 || kb > NBLK){
+    printf("logbench: bad write size %d\n", kb);
+    exit(1);
+  }
+  if((buf = malloc(kb * BSIZE)) == 0){
+    printf("logbench: malloc failed\n");
+    exit(1);
+  }
+  memset(buf, 'w', kb * BSIZE);
+
+  start = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    if((fd = open("logbench.tmp", O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+      printf("logbench: create failed\n");
+      exit(1);
+    }
+    for(i = 0; i < NBLK; i += n){
+      n = NBLK - i < kb ? NBLK - i : kb;
+      if(write(fd, buf, n * BSIZE) != n * BSIZE){
+        printf("logbench: write failed at block %d\n", i);
+        exit(1);
+      }
+      if(dosync && fsync(fd) < 0){
+        printf("logbench: fsync failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink("logbench.tmp");
+  }
+  t = uptime() - start;
+
+  printf("logbench: %d KB in %dKB writes%s: %d ticks", ROUNDS * NBLK, kb,
+         dosync ? " with fsync" : "", t);
+  if(t > 0)
+    printf(", %d KB/tick", ROUNDS * NBLK / t);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,168 @@
+// Measure how well the buffer cache keeps hot metadata while
+// a bulk scan runs alongside.
+//
+// The metadata workload stats NMETA files in a directory, which
+// touches the directory's blocks and the inode blocks.  It is
+// timed once alone and once while a child reads through large
+// files totalling more blocks than the cache holds.  With a
+// scan-resistant policy the two times stay close; with strict
+// LRU (make BCACHE=lru) the scan evicts the metadata and every
+// stat goes to the disk.
+//
+// Usage: scanbench [scan-blocks]
+// The default scan needs a large file system (make LAB=fs).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NMETA   64
+#define ROUNDS  200
+#define FILEBLK 256     // blocks per bulk file, below MAXFILE
+
+char buf[BSIZE];
+
+void
+name(char *p, char *prefix, int i)
+{
+  strcpy(p, prefix);
+  p += strlen(p);
+  p[0] = '0' + i / 10;
+  p[1] = '0' + i % 10;
+  p[2] = 0;
+}
+
+void
+mkmeta(void)
+{
+  char path[32];
+  int i, fd;
+
+  mkdir("sbdir");
+  for(i = 0; i < NMETA; i++){
+    name(path, "sbdir/m", i);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      printf("scanbench: create %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+}
+
+// Create bulk files holding up to nblocks blocks; return the number of files.
+int
+mkbulk(int nblocks)
+{
+  char path[32];
+  int f, b, fd, done;
+
+  done = 0;
+  memset(buf, 'x', sizeof(buf));
+  for(f = 0; done < nblocks && f < 100; f++){
+    name(path, "sbbulk", f);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0)
+      break;
+    for(b = 0; b < FILEBLK && done < nblocks; b++, done++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("scanbench: disk full after %d blocks\n", done);
+        close(fd);
+        return f + 1;
+      }
+    }
+    close(fd);
+  }
+  return f;
+}
+
+// Read through the bulk files forever.
+void
+scanner(int nfiles)
+{
+  char path[32];
+  int f, fd;
+
+  for(;;){
+    for(f = 0; f < nfiles; f++){
+      name(path, "sbbulk", f);
+      if((fd = open(path, O_RDONLY)) < 0)
+        exit(1);
+      while(read(fd, buf, sizeof(buf)) > 0)
+        ;
+      close(fd);
+    }
+  }
+}
+
+// Return ticks taken by ROUNDS passes of stat over the metadata files.
+int
+metaload(void)
+{
+  char path[32];
+  struct stat st;
+  int r, i, start;
+
+  start = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < NMETA; i++){
+      name(path, "sbdir/m", i);
+      if(stat(path, &st) < 0){
+        printf("scanbench: stat %s failed\n", path);
+        exit(1);
+      }
+    }
+  }
+  return uptime() - start;
+}
+
+void
+cleanup(int nfiles)
+{
+  char path[32];
+  int i;
+
+  for(i = 0; i < NMETA; i++){
+    name(path, "sbdir/m", i);
+    unlink(path);
+  }
+  unlink("sbdir");
+  for(i = 0; i < nfiles; i++){
+    name(path, "sbbulk", i);
+    unlink(path);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nblocks, nfiles, pid, alone, scanned;
+
+  nblocks = 3000;
+  if(argc > 1)
+    nblocks = atoi(argv[1]);
+
+  mkmeta();
+  nfiles = mkbulk(nblocks);
+  printf("scanbench: %d metadata files, %d bulk files\n", NMETA, nfiles);
+
+  metaload();  // warm the cache
+  alone = metaload();
+
+  if((pid = fork()) < 0){
+    printf("scanbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    scanner(nfiles);
+  sleep(10);   // let the scan get going
+  scanned = metaload();
+  kill(pid);
+  wait(0);
+
+  printf("scanbench: metadata alone: %d ticks\n", alone);
+  printf("scanbench: metadata during scan: %d ticks\n", scanned);
+
+  cleanup(nfiles);
+  exit(0);
+}
@@ -67,7 +67,19 @@ main(int argc, char *argv[])
         printf( "Snapshot creation failed with code %d\n", result);
         exit(1);
     }
-    
+
+    // Verify the checksums of the captured blocks
+    if (snapverify(0) == 0) {
+        printf( "Snapshot verified successfully!\n");
+    } else {
+        printf( "Snapshot verification failed\n");
+        exit(1);
+    }
+    if (snapverify(1) == 0) {
+        printf( "snapverify accepted a nonexistent snapshot\n");
+        exit(1);
+    }
+
     // Make some changes after snapshot
     printf( "\n=== Making changes after snapshot ===\n");
     
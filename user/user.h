@@ -22,6 +22,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int fdatasync(int);
+int lseek(int, int, int);
+int fallocate(int, int, int);
+int fruns(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -42,4 +47,5 @@ void *memcpy(void *, const void *, uint);
 void* malloc(uint);
 void free(void*);
 int snap(void);
-int restore(void);
\ No newline at end of file
+int restore(void);
+int snapverify(int);
\ No newline at end of file
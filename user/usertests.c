@@ -537,6 +537,390 @@ opentest(char *s)
   }
 }
 
+// O_DIRECT reads must see data that may still be
+// cached but not yet written to its home block.
+void
+directread(char *s)
+{
+  int fd, i, n;
+  enum { N=3*BSIZE+100 };
+
+  fd = open("direct", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat direct failed!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, N) != N){
+    printf("%s: error: write direct failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("direct", O_RDONLY|O_DIRECT);
+  if(fd < 0){
+    printf("%s: error: open direct failed!\n", s);
+    exit(1);
+  }
+  memset(buf, 0, N);
+  // read in pieces that straddle block boundaries
+  for(i = 0; i < N; i += n){
+    if((n = read(fd, buf+i, 700)) <= 0){
+      printf("%s: read direct failed at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    if(buf[i] != 'a' + i % 23){
+      printf("%s: wrong byte %d in direct read\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(unlink("direct") < 0){
+    printf("%s: unlink direct failed\n", s);
+    exit(1);
+  }
+}
+
+// files mapped by extents: two appended to a block at a time in
+// turn, reopened each time so that they keep no reservation
+// window, get an extent per block and spill into the extent block.
+void
+extentfile(char *s)
+{
+  int fd[2], i, k, n;
+  char *names[2] = { "ext0", "ext1" };
+  enum { N = 24 };
+
+  for(k = 0; k < 2; k++){
+    fd[k] = open(names[k], O_CREATE|O_RDWR|O_EXTENT);
+    if(fd[k] < 0){
+      printf("%s: error: creat %s failed!\n", s, names[k]);
+      exit(1);
+    }
+    close(fd[k]);
+  }
+  for(i = 0; i < N; i++){
+    for(k = 0; k < 2; k++){
+      memset(buf, 'a' + k, BSIZE);
+      ((int*)buf)[0] = i;
+      if((fd[k] = open(names[k], O_RDWR)) < 0 ||
+         lseek(fd[k], 0, SEEK_END) != i*BSIZE ||
+         write(fd[k], buf, BSIZE) != BSIZE){
+        printf("%s: error: write %s failed\n", s, names[k]);
+        exit(1);
+      }
+      if(k == 1 || i < N-1)
+        close(fd[k]);
+    }
+  }
+  // a contiguous append of many blocks.
+  for(i = 0; i < 8*BSIZE; i++)
+    buf[i] = i % 251;
+  if(write(fd[0], buf, 8*BSIZE) != 8*BSIZE){
+    printf("%s: error: long write failed\n", s);
+    exit(1);
+  }
+  // overwrite a block in the middle.
+  memset(buf, 'z', BSIZE);
+  if(lseek(fd[0], 5*BSIZE, SEEK_SET) != 5*BSIZE ||
+     write(fd[0], buf, BSIZE) != BSIZE){
+    printf("%s: error: overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd[0]);
+
+  fd[0] = open(names[0], O_RDONLY);
+  for(i = 0; i < N; i++){
+    if((n = read(fd[0], buf, BSIZE)) != BSIZE){
+      printf("%s: read %s failed at %d: %d\n", s, names[0], i, n);
+      exit(1);
+    }
+    if(i == 5 ? buf[100] != 'z' : ((int*)buf)[0] != i || buf[100] != 'a'){
+      printf("%s: wrong data in block %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd[0], buf, 8*BSIZE) != 8*BSIZE){
+    printf("%s: long read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 8*BSIZE; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong byte %d in long read\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd[0], buf, 1) != 0){
+    printf("%s: read past the end\n", s);
+    exit(1);
+  }
+  close(fd[0]);
+
+  // truncation frees the extents, and the file is reusable.
+  fd[1] = open(names[1], O_RDWR|O_TRUNC);
+  if(fd[1] < 0 || write(fd[1], "x", 1) != 1){
+    printf("%s: rewrite %s failed\n", s, names[1]);
+    exit(1);
+  }
+  close(fd[1]);
+
+  for(k = 0; k < 2; k++){
+    if(unlink(names[k]) < 0){
+      printf("%s: unlink %s failed\n", s, names[k]);
+      exit(1);
+    }
+  }
+}
+
+// fallocate() extends a file with zeros, in one run when the
+// free space allows, leaves a file alone that is long enough
+// already, and refuses pipes.
+void
+fallocatetest(char *s)
+{
+  int fd, i, k, fds[2];
+  struct stat st;
+
+  for(k = 0; k < 2; k++){
+    fd = open("falloc", O_CREATE|O_RDWR|O_TRUNC|(k ? O_EXTENT : 0));
+    if(fd < 0){
+      printf("%s: error: creat falloc failed!\n", s);
+      exit(1);
+    }
+    if(write(fd, "0123456789", 10) != 10){
+      printf("%s: error: write falloc failed\n", s);
+      exit(1);
+    }
+    if(fallocate(fd, 0, 40*BSIZE) != 0 || fallocate(fd, BSIZE, BSIZE) != 0){
+      printf("%s: fallocate failed\n", s);
+      exit(1);
+    }
+    if(fstat(fd, &st) < 0 || st.size != 40*BSIZE || fruns(fd) <= 0){
+      printf("%s: fallocate left size %d\n", s, (int)st.size);
+      exit(1);
+    }
+    if(lseek(fd, 0, SEEK_SET) != 0){
+      printf("%s: lseek failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < 40; i++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("%s: read falloc failed at %d\n", s, i);
+        exit(1);
+      }
+      if(i == 0 ? memcmp(buf, "0123456789", 10) != 0 || buf[10] != 0 :
+         buf[0] != 0 || buf[BSIZE-1] != 0){
+        printf("%s: wrong data in block %d\n", s, i);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  if(unlink("falloc") < 0){
+    printf("%s: unlink falloc failed\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fallocate(fds[1], 0, BSIZE) != -1){
+    printf("%s: fallocate of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a directory big enough to be hashed and split: every name
+// is found, reading it as raw dirents shows each once, and it
+// can be emptied and removed.
+void
+hashdir(char *s)
+{
+  enum { N = 400 };
+  char name[16], seen[N];
+  struct dirent de;
+  int fd, i, n;
+
+  if(mkdir("hd") < 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  fd = open("hd/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create hd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  strcpy(name, "hd/x000");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if(link("hd/f", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(link("hd/f", name) == 0){
+      printf("%s: link %s twice\n", s, name);
+      exit(1);
+    }
+  }
+
+  memset(seen, 0, sizeof(seen));
+  if((fd = open("hd", O_RDONLY)) < 0){
+    printf("%s: open hd failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || de.name[0] != 'x')
+      continue;
+    i = (de.name[1]-'0')*100 + (de.name[2]-'0')*10 + de.name[3]-'0';
+    if(i < 0 || i >= N || seen[i]){
+      printf("%s: bad or repeated entry %s\n", s, de.name);
+      exit(1);
+    }
+    seen[i] = 1;
+    n++;
+  }
+  close(fd);
+  if(n != N){
+    printf("%s: read %d entries, not %d\n", s, n, N);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 100;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlinked non-empty hd\n", s);
+    exit(1);
+  }
+  if(unlink("hd/f") < 0 || unlink("hd") < 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// more inodes in use at once than the inode table starts
+// with, and the files found again once they are all closed.
+void
+icache(char *s)
+{
+  enum { NCHILD = 5, N = 12 };
+  int c, i, fds[N], pid, xstatus;
+  char name[4];
+  struct stat st;
+
+  for(c = 0; c < NCHILD; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'i';
+      name[1] = 'a' + c;
+      name[3] = '\0';
+      for(i = 0; i < N; i++){
+        name[2] = 'a' + i;
+        fds[i] = open(name, O_CREATE|O_RDWR);
+        if(fds[i] < 0 || write(fds[i], name, i+1) != i+1){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      sleep(5);  // hold them while the other children do
+      for(i = 0; i < N; i++)
+        close(fds[i]);
+      for(i = 0; i < N; i++){
+        name[2] = 'a' + i;
+        if(stat(name, &st) < 0 || st.size != i+1){
+          printf("%s: stat %s failed\n", s, name);
+          exit(1);
+        }
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  for(c = 0; c < NCHILD; c++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// fsync() and fdatasync() return once a file's changes are on
+// disk, and refuse pipes.
+void
+fsynctest(char *s)
+{
+  int fd, i, fds[2];
+
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat fsync failed!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: error: write fsync failed\n", s);
+      exit(1);
+    }
+    if((i % 2 ? fdatasync(fd) : fsync(fd)) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  // nothing changed since the last one.
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(unlink("fsync") < 0){
+    printf("%s: unlink fsync failed\n", s);
+    exit(1);
+  }
+}
+
 void
 writetest(char *s)
 {
@@ -578,10 +962,12 @@ writetest(char *s)
   }
 }
 
+// write a file that reaches into the double-indirect blocks.
 void
 writebig(char *s)
 {
   int i, fd, n;
+  enum { NBIG = NDIRECT + NINDIRECT + NINDIRECT + 10 };
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -589,7 +975,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +995,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -2604,6 +2990,12 @@ struct test {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {directread, "directread"},
+  {fsynctest, "fsynctest"},
+  {extentfile, "extentfile"},
+  {fallocatetest, "fallocatetest"},
+  {icache, "icache"},
+  {hashdir, "hashdir"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
@@ -2699,6 +3091,47 @@ bigdir(char *s)
   }
 }
 
+// more entries than a hashed directory's index has leaves for,
+// all found again and removed.
+void
+hashdirfull(char *s)
+{
+  enum { N = 4500 };
+  char name[16];
+  int fd, i;
+
+  if(mkdir("hf") < 0 || (fd = open("hf/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create hf/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  strcpy(name, "hf/x0000");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 1000;
+    name[5] = '0' + i / 100 % 10;
+    name[6] = '0' + i / 10 % 10;
+    name[7] = '0' + i % 10;
+    if(link("hf/f", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 1000;
+    name[5] = '0' + i / 100 % 10;
+    name[6] = '0' + i / 10 % 10;
+    name[7] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hf/f") < 0 || unlink("hf") < 0){
+    printf("%s: unlink hf failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2941,6 +3374,7 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {hashdirfull, "hashdirfull"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
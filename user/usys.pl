@@ -37,4 +37,10 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("snap");
-entry("restore");
\ No newline at end of file
+entry("restore");
+entry("snapverify");
+entry("fsync");
+entry("fdatasync");
+entry("lseek");
+entry("fallocate");
+entry("fruns");
\ No newline at end of file